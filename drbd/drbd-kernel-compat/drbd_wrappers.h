@@ -307,6 +307,27 @@ extern int blkdev_issue_zeroout(struct block_device *bdev, sector_t sector,
 # endif
 #endif
 
+/* Before bio->bi_ioprio, bios carried no I/O priority of their own */
+static inline void drbd_bio_set_ioprio(struct bio *bio, unsigned short ioprio)
+{
+#ifdef COMPAT_HAVE_BIO_BI_IOPRIO
+	bio->bi_ioprio = ioprio;
+#endif
+}
+
+/* Does the backing device have a volatile write cache, which needs flushes?
+ * Where we cannot ask, assume it does: a flush too many is only slow. */
+static inline bool drbd_bdev_write_cache(struct block_device *bdev)
+{
+#if defined(COMPAT_HAVE_BDEV_WRITE_CACHE)
+	return bdev_write_cache(bdev);
+#elif defined(COMPAT_HAVE_QUEUE_FLAG_WC)
+	return test_bit(QUEUE_FLAG_WC, &bdev_get_queue(bdev)->queue_flags);
+#else
+	return true;
+#endif
+}
+
 #ifndef list_next_rcu
 #define list_next_rcu(list)	(*((struct list_head **)(&(list)->next)))
 #endif
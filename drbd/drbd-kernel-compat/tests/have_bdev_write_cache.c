@@ -0,0 +1,8 @@
+/* { "version": "v5.19-rc1", "comment": "bdev_write_cache() was introduced; since v6.11 it is the only way to ask whether a device has a volatile write cache" } */
+
+#include <linux/blkdev.h>
+
+bool foo(struct block_device *bdev)
+{
+	return bdev_write_cache(bdev);
+}
@@ -0,0 +1,7 @@
+/* { "version": "v4.10", "comment": "the I/O priority moved out of bio->bi_rw into its own field bio->bi_ioprio" } */
+#include <linux/bio.h>
+
+void dummy(struct bio *bio)
+{
+	bio->bi_ioprio = 0;
+}
@@ -0,0 +1,8 @@
+/* { "version": "v4.7-rc1", "comment": "QUEUE_FLAG_WC was introduced to flag a volatile write back cache on the queue; gone with v6.11, it became the queue limit feature BLK_FEAT_WRITE_CACHE" } */
+
+#include <linux/blkdev.h>
+
+int foo(void)
+{
+	return QUEUE_FLAG_WC;
+}
@@ -1286,6 +1286,46 @@ out:
 	return set;
 }
 
+/**
+ * drbd_set_in_sync_paused_sources  -  Share resync progress with paused sources
+ * @peer_device: the peer device we are currently L_SYNC_TARGET of
+ * @sector:	start sector of the range that is now in sync
+ * @size:	size of the range in bytes
+ *
+ * While we are sync target of one peer, resync from other UpToDate peers is
+ * paused (resync_susp_other_c).  If such a peer has the same current UUID as
+ * our sync source, a block we got from the sync source is in sync with that
+ * peer as well.  Clear it in that peer's bitmap, so that it does not get
+ * transferred again if resync has to continue from there.
+ */
+void drbd_set_in_sync_paused_sources(struct drbd_peer_device *peer_device, sector_t sector, int size)
+{
+	struct drbd_device *device = peer_device->device;
+	u64 source_uuid = peer_device->current_uuid & ~UUID_PRIMARY;
+	struct drbd_peer_device *p;
+	unsigned long mask = 0;
+
+	if (peer_device->disk_state[NOW] != D_UP_TO_DATE)
+		return;
+
+	rcu_read_lock();
+	for_each_peer_device_rcu(p, device) {
+		if (p == peer_device || p->bitmap_index == -1)
+			continue;
+		if (p->repl_state[NOW] != L_PAUSED_SYNC_T || !p->resync_susp_other_c[NOW])
+			continue;
+		if (p->disk_state[NOW] != D_UP_TO_DATE)
+			continue;
+		if ((p->current_uuid & ~UUID_PRIMARY) != source_uuid)
+			continue;
+		mask |= 1UL << p->bitmap_index;
+	}
+	rcu_read_unlock();
+
+	if (mask)
+		drbd_set_sync(device, sector, size, 0, mask);
+}
+
 static
 struct bm_extent *_bme_get(struct drbd_peer_device *peer_device, unsigned int enr)
 {
@@ -489,6 +489,11 @@ ____bm_op(struct drbd_device *device, unsigned int bitmap_index, unsigned long s
 	if (end >= bitmap->bm_bits)
 		end = bitmap->bm_bits - 1;
 
+	/* bm_set[] is exact while we hold the bm_lock (or the bitmap is
+	 * locked for bulk operations).  No need to walk a clean bitmap. */
+	if (op == BM_OP_FIND_BIT && !bitmap->bm_set[bitmap_index])
+		return DRBD_END_OF_BITMAP;
+
 	word = interleaved_word32(bitmap, bitmap_index, start);
 	page = word32_to_page(word);
 	bit_in_page = (word32_in_page(word) << 5) | (start & 31);
@@ -576,11 +581,16 @@ ____bm_op(struct drbd_device *device, unsigned int bitmap_index, unsigned long s
 				*buffer++ = *p;
 				break;
 			case BM_OP_FIND_BIT:
+				/* clean areas are the common case, skip them cheaply */
+				if (!*p)
+					break;
 				count = find_next_bit_le(addr, bit_in_page + 32, bit_in_page);
 				if (count < bit_in_page + 32)
 					goto found;
 				break;
 			case BM_OP_FIND_ZERO_BIT:
+				if (*p == cpu_to_le32(~0U))
+					break;
 				count = find_next_zero_bit_le(addr, bit_in_page + 32, bit_in_page);
 				if (count < bit_in_page + 32)
 					goto found;
@@ -1160,7 +1170,14 @@ static void bm_page_io_async(struct drbd_bm_aio_ctx *ctx, int page_nr) __must_ho
 	bio_add_page(bio, page, len, 0);
 	bio->bi_private = ctx;
 	bio->bi_end_io = drbd_bm_endio;
-	bio->bi_opf = op;
+	/* Lazy writeout only records resync progress. Everything else is
+	 * waited for, like meta data updates in _drbd_md_sync_page_io(). */
+	if (ctx->flags & BM_AIO_WRITE_LAZY) {
+		bio->bi_opf = op | REQ_META;
+		drbd_set_resync_ioprio(bio);
+	} else {
+		bio->bi_opf = op | REQ_META | REQ_PRIO;
+	}
 
 	if (drbd_insert_fault(device, (op == REQ_OP_WRITE) ? DRBD_FAULT_MD_WR : DRBD_FAULT_MD_RD)) {
 		bio->bi_status = BLK_STS_IOERR;
@@ -1464,6 +1481,14 @@ unsigned long drbd_bm_find_next(struct drbd_peer_device *peer_device, unsigned l
 		     BM_OP_FIND_BIT, NULL);
 }
 
+/* next clear bit, only looking at bits start .. end */
+unsigned long drbd_bm_range_find_next_zero(struct drbd_peer_device *peer_device,
+					   unsigned long start, unsigned long end)
+{
+	return bm_op(peer_device->device, peer_device->bitmap_index, start, end,
+		     BM_OP_FIND_ZERO_BIT, NULL);
+}
+
 /* does not spin_lock_irqsave.
  * you must take drbd_bm_lock() first */
 unsigned long _drbd_bm_find_next(struct drbd_peer_device *peer_device, unsigned long start)
@@ -870,6 +870,49 @@ static int connection_debug_show(struct seq_file *m, void *ignored)
 		atomic_read(&connection->done_ee_cnt),
 		atomic_read(&connection->active_ee_cnt));
 	seq_printf(m, "      agreed_pro_version: %d\n", connection->agreed_pro_version);
+	seq_printf(m, " peer_acks sent / merged: %u / %u\n",
+		   connection->peer_acks_sent, connection->peer_acks_merged);
+
+	u1 = connection->ahead.rate;
+	seq_printf(m, "        ahead drain_rate: %u KiB/s\n", u1);
+	if (u1) {
+		struct drbd_peer_device *peer_device;
+		unsigned long long oos = 0;
+		int vnr;
+
+		in_flight = atomic_read(&connection->ap_in_flight);
+		seq_printf(m, "          ahead drain_ms: %llu\n",
+			   div_u64((u64)in_flight / 2 * 1000, u1));
+
+		rcu_read_lock();
+		idr_for_each_entry(&connection->peer_devices, peer_device, vnr) {
+			if (!get_ldev_if_state(peer_device->device, D_FAILED))
+				continue;
+			oos += Bit2KB((unsigned long long)drbd_bm_total_weight(peer_device));
+			put_ldev(peer_device->device);
+		}
+		rcu_read_unlock();
+		seq_printf(m, "       ahead catch_up_ms: %llu\n", div_u64(oos * 1000, u1));
+	}
+	seq_printf(m, "           ahead hold_ms: %u\n"
+		      "           ahead entered: %u\n"
+		      "             ahead flaps: %u\n",
+		   connection->ahead.hold_ms,
+		   connection->ahead.entered,
+		   connection->ahead.flaps);
+
+	seq_printf(m, "       dedup cache_slots: %u\n"
+		      "     dedup blocks / hits: %lu / %lu\n",
+		   connection->dedup.slots,
+		   connection->dedup.blocks,
+		   connection->dedup.hits);
+	seq_printf(m, "      delta cache_blocks: %u\n"
+		      "     delta blocks / hits: %lu / %lu\n"
+		      "       delta changed_kib: %llu\n",
+		   connection->delta.entries,
+		   connection->delta.blocks,
+		   connection->delta.hits,
+		   connection->delta.changed_bytes >> 10);
 	return 0;
 }
 
@@ -1101,6 +1144,32 @@ static int device_io_frozen_show(struct seq_file *m, void *ignored)
 	return 0;
 }
 
+static int device_write_conflicts_show(struct seq_file *m, void *ignored)
+{
+	struct drbd_device *device = m->private;
+	unsigned long lookups, skipped;
+	unsigned int wide, used = 0;
+	int i;
+
+	/* BUMP me if you change the file format/content/presentation */
+	seq_printf(m, "v: %u\n\n", 0);
+
+	spin_lock_irq(&device->resource->req_lock);
+	lookups = device->write_summary_lookups;
+	skipped = device->write_summary_skipped;
+	wide = device->write_summary_wide;
+	for (i = 0; i < WRITE_SUMMARY_SLOTS; i++)
+		used += device->write_summary[i] != 0;
+	spin_unlock_irq(&device->resource->req_lock);
+
+	seq_printf(m, "summary lookups: %lu\n", lookups);
+	seq_printf(m, "summary skipped tree: %lu\n", skipped);
+	seq_printf(m, "summary slots in use: %u/%u\n", used, WRITE_SUMMARY_SLOTS);
+	seq_printf(m, "summary wide intervals: %u\n", wide);
+
+	return 0;
+}
+
 static int device_ed_gen_id_show(struct seq_file *m, void *ignored)
 {
 	struct drbd_device *device = m->private;
@@ -1226,6 +1295,7 @@ drbd_debugfs_device_attr(io_frozen)
 drbd_debugfs_device_attr(ed_gen_id)
 drbd_debugfs_device_attr(openers)
 drbd_debugfs_device_attr(md_io)
+drbd_debugfs_device_attr(write_conflicts)
 #ifdef CONFIG_DRBD_TIMING_STATS
 __drbd_debugfs_device_attr(req_timing, device_req_timing_write)
 #endif
@@ -1265,6 +1335,7 @@ void drbd_debugfs_device_add(struct drbd_device *device)
 	vol_dcf(ed_gen_id);
 	vol_dcf(openers);
 	vol_dcf(md_io);
+	vol_dcf(write_conflicts);
 #ifdef CONFIG_DRBD_TIMING_STATS
 	drbd_dcf(device->debugfs_vol, device, req_timing, 0600);
 #endif
@@ -1293,6 +1364,7 @@ void drbd_debugfs_device_cleanup(struct drbd_device *device)
 	drbd_debugfs_remove(&device->debugfs_vol_ed_gen_id);
 	drbd_debugfs_remove(&device->debugfs_vol_openers);
 	drbd_debugfs_remove(&device->debugfs_vol_md_io);
+	drbd_debugfs_remove(&device->debugfs_vol_write_conflicts);
 #ifdef CONFIG_DRBD_TIMING_STATS
 	drbd_debugfs_remove(&device->debugfs_vol_req_timing);
 #endif
@@ -1627,12 +1699,54 @@ static int peer_device_proc_drbd_show(struct seq_file *m, void *ignored)
 		atomic_read(&device->wait_for_actlog),	/* peer_requests */
 		/* nr extents needed to satisfy the above in the worst case */
 		atomic_read(&device->wait_for_actlog_ecnt));
+	seq_printf(m, "\tsent as zeroes: ns:%u rs:%lu\n",
+		peer_device->send_zeroes_cnt/2,
+		Bit2KB(peer_device->rs_deallocated));
 
 	rcu_read_unlock();
 
 	return 0;
 }
 
+static int peer_device_resync_controller_show(struct seq_file *m, void *ignored)
+{
+	struct drbd_peer_device *peer_device = m->private;
+
+	/* BUMP me if you change the file format/content/presentation */
+	seq_printf(m, "v: %u\n\n", 1);
+
+	seq_printf(m, "latency_target_us: %u\n", drbd_rs_latency_target_us);
+	seq_printf(m, "rtt_us: %llu\n", div_u64(peer_device->rs_lat.rtt_ns, NSEC_PER_USEC));
+	seq_printf(m, "want_sectors: %u\n", peer_device->rs_lat.want);
+	seq_printf(m, "in_flight_sectors: %d\n", peer_device->rs_in_flight);
+	seq_printf(m, "sync_rate_kbps: %d\n", peer_device->c_sync_rate);
+	seq_printf(m, "increases: %u\n", peer_device->rs_lat.increases);
+	seq_printf(m, "decreases: %u\n", peer_device->rs_lat.decreases);
+	seq_printf(m, "app_latency_target_us: %u\n", drbd_rs_app_latency_us);
+	seq_printf(m, "app_latency_us: %lu\n", READ_ONCE(peer_device->device->app_lat_us));
+	return 0;
+}
+
+static int peer_device_resync_requests_show(struct seq_file *m, void *ignored)
+{
+	struct drbd_peer_device *peer_device = m->private;
+	int i;
+
+	/* BUMP me if you change the file format/content/presentation */
+	seq_printf(m, "v: %u\n\n", 2);
+
+	seq_puts(m, "size_kib requests reads\n");
+	for (i = 0; i < RS_REQ_SIZE_BUCKETS; i++)
+		seq_printf(m, "%8u %8u %u\n", (BM_BLOCK_SIZE >> 10) << i,
+			   peer_device->rs_req_sizes[i],
+			   peer_device->rs_src.sizes[i]);
+	seq_printf(m, "\nreads: %u contiguous: %u\n",
+		   peer_device->rs_src.reads, peer_device->rs_src.contiguous);
+	seq_printf(m, "\nrs_deallocated_kib: %lu\n",
+		   Bit2KB(peer_device->rs_deallocated));
+	return 0;
+}
+
 #define drbd_debugfs_peer_device_attr(name)					\
 static int peer_device_ ## name ## _open(struct inode *inode, struct file *file)\
 {										\
@@ -1658,6 +1772,8 @@ static const struct file_operations peer_device_ ## name ## _fops = {		\
 
 drbd_debugfs_peer_device_attr(resync_extents)
 drbd_debugfs_peer_device_attr(proc_drbd)
+drbd_debugfs_peer_device_attr(resync_controller)
+drbd_debugfs_peer_device_attr(resync_requests)
 
 void drbd_debugfs_peer_device_add(struct drbd_peer_device *peer_device)
 {
@@ -1672,10 +1788,14 @@ void drbd_debugfs_peer_device_add(struct drbd_peer_device *peer_device)
 	/* debugfs create file */
 	peer_dev_dcf(resync_extents);
 	peer_dev_dcf(proc_drbd);
+	peer_dev_dcf(resync_controller);
+	peer_dev_dcf(resync_requests);
 }
 
 void drbd_debugfs_peer_device_cleanup(struct drbd_peer_device *peer_device)
 {
+	drbd_debugfs_remove(&peer_device->debugfs_peer_dev_resync_requests);
+	drbd_debugfs_remove(&peer_device->debugfs_peer_dev_resync_controller);
 	drbd_debugfs_remove(&peer_device->debugfs_peer_dev_proc_drbd);
 	drbd_debugfs_remove(&peer_device->debugfs_peer_dev_resync_extents);
 	drbd_debugfs_remove(&peer_device->debugfs_peer_dev);
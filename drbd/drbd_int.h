@@ -30,6 +30,7 @@
 #include <linux/backing-dev.h>
 #include <linux/genhd.h>
 #include <linux/idr.h>
+#include <linux/ioprio.h>
 #include <linux/lru_cache.h>
 #include <linux/prefetch.h>
 #include <linux/drbd_genl_api.h>
@@ -60,6 +61,17 @@
 /* module parameter, defined in drbd_main.c */
 extern unsigned int drbd_minor_count;
 extern unsigned int drbd_protocol_version_min;
+extern unsigned int drbd_rs_latency_target_us;
+extern bool drbd_send_zeroes;
+extern unsigned int drbd_rs_app_latency_us;
+extern unsigned int drbd_dedup_cache_kib;
+extern unsigned int drbd_delta_cache_kib;
+extern unsigned int drbd_peer_ack_idle_delay_ms;
+extern unsigned int drbd_resync_ioprio_class;
+extern unsigned int drbd_resync_ioprio_level;
+extern unsigned int drbd_verify_gib_per_hour;
+extern bool drbd_verify_auto_resume;
+extern unsigned int drbd_congestion_grace_ms;
 
 #ifdef CONFIG_DRBD_FAULT_INJECTION
 extern int drbd_enable_faults;
@@ -144,6 +156,7 @@ extern struct mutex resources_mutex;
 
 /* for sending/receiving the bitmap,
  * possibly in some encoding scheme */
+#define BM_XFER_RLE_MAX_BACKOFF 8U
 struct bm_xfer_ctx {
 	/* "const"
 	 * stores total bits and long words
@@ -155,6 +168,11 @@ struct bm_xfer_ctx {
 	unsigned long bit_offset;
 	unsigned long word_offset;
 
+	/* after an incompressible chunk, skip this many RLE attempts;
+	 * the skip count doubles with each further miss */
+	unsigned int rle_skip;
+	unsigned int rle_backoff;
+
 	/* statistics; index: (h->command == P_BITMAP) */
 	unsigned packets[2];
 	unsigned bytes[2];
@@ -295,6 +313,9 @@ struct drbd_request {
 	unsigned long pre_submit_jif;
 	unsigned long pre_send_jif[DRBD_PEERS_MAX];
 
+	/* for drbd_rs_c_min_rate_throttle(), only if resync_app_latency_us is set */
+	ktime_t local_submit_kt;
+
 #ifdef CONFIG_DRBD_TIMING_STATS
 	/* for DRBD internal statistics */
 	ktime_t start_kt;
@@ -353,6 +374,10 @@ struct drbd_request {
 
 	unsigned int local_rq_state;
 	u16 net_rq_state[DRBD_NODE_ID_MAX];
+
+	/* see req_all_zero(): 0 not yet looked at, 1 all zero, 2 not,
+	 * so the payload is scanned once per request, not once per peer */
+	u8 all_zero;
 };
 
 struct drbd_epoch {
@@ -397,6 +422,8 @@ struct drbd_peer_request {
 		struct { /* regular peer_request */
 			struct drbd_epoch *epoch; /* for writes */
 			unsigned long submit_jif;
+			/* EE_APPLICATION only, if resync_app_latency_us is set */
+			ktime_t submit_kt;
 			union {
 				u64 block_id;
 				struct digest_info *digest;
@@ -483,6 +510,11 @@ enum {
 
 	/* Hold reference in activity log */
 	__EE_IN_ACTLOG,
+
+	/* online verify digest already computed, see queue_verify_digest() */
+	__EE_DIGEST_DONE,
+	/* ... and it matched the one the peer sent */
+	__EE_DIGEST_EQUAL,
 };
 #define EE_MAY_SET_IN_SYNC     (1<<__EE_MAY_SET_IN_SYNC)
 #define EE_SET_OUT_OF_SYNC     (1<<__EE_SET_OUT_OF_SYNC)
@@ -501,6 +533,8 @@ enum {
 #define EE_APPLICATION		(1<<__EE_APPLICATION)
 #define EE_RS_THIN_REQ		(1<<__EE_RS_THIN_REQ)
 #define EE_IN_ACTLOG		(1<<__EE_IN_ACTLOG)
+#define EE_DIGEST_DONE		(1<<__EE_DIGEST_DONE)
+#define EE_DIGEST_EQUAL		(1<<__EE_DIGEST_EQUAL)
 
 /* flag bits per device */
 enum device_flag {
@@ -549,6 +583,8 @@ enum peer_device_flag {
 	RS_PROGRESS,		/* tell worker that resync made significant progress */
 	RS_LAZY_BM_WRITE,	/*  -"- and bitmap writeout should be efficient now */
 	RS_DONE,		/* tell worker that resync is done */
+	OV_RESUME,		/* tell worker to resume an interrupted online verify */
+	OV_INTERRUPTED,		/* online verify was cut short by a connection loss */
 	B_RS_H_DONE,		/* Before resync handler done (already executed) */
 	DISCARD_MY_DATA,	/* discard_my_data flag per volume */
 	USE_DEGR_WFC_T,		/* degr-wfc-timeout instead of wfc-timeout. */
@@ -964,6 +1000,7 @@ struct drbd_connection {
 
 	struct drbd_send_buffer send_buffer[2];
 	struct mutex mutex[2]; /* Protect assembling of new packet until sending it (in send_buffer) */
+	unsigned int cork_count[2]; /* see drbd_cork_nested() */
 	/* scratch buffers for use while "owning" the DATA_STREAM send_buffer,
 	 * to avoid larger on-stack temporary variables,
 	 * introduced for holding digests in drbd_send_dblock() */
@@ -980,6 +1017,32 @@ struct drbd_connection {
 	unsigned long last_received;	/* in jiffies, either socket */
 	atomic_t ap_in_flight; /* App sectors in flight (waiting for ack) */
 	atomic_t rs_in_flight; /* Resync sectors in flight */
+	unsigned int peer_acks_sent;
+	unsigned int peer_acks_merged; /* covered by a later P_PEER_ACK, not sent */
+	bool sender_corked_control; /* see drbd_sender_uncork_control() */
+	struct {
+		unsigned long mark_jif;	/* start of the current drain sample */
+		unsigned int mark_sect;	/* ap sectors acked since mark_jif */
+		unsigned int rate;	/* smoothed KiB/s acked by the peer */
+		unsigned long since;	/* jiffies, last pulled ahead */
+		unsigned long left;	/* jiffies, last went Ahead -> SyncSource */
+		unsigned int hold_ms;	/* minimum time to stay Ahead */
+		unsigned int entered;	/* times pulled ahead */
+		unsigned int flaps;	/* ... of those soon after going back to sync */
+	} ahead;
+	struct {
+		u32 *hashes;		/* see dedup_account() */
+		unsigned int slots;
+		unsigned long blocks;	/* 4 KiB blocks of plain writes sent */
+		unsigned long hits;	/* ... found in the hash cache */
+	} dedup;
+	struct {
+		struct delta_entry *cache;	/* see delta_account() */
+		unsigned int entries;
+		unsigned long blocks;	/* aligned 4 KiB blocks written, protocol A */
+		unsigned long hits;	/* ... of which the previous content was cached */
+		unsigned long long changed_bytes; /* ... in chunks that changed */
+	} delta;
 
 	struct drbd_work connect_timer_work;
 	struct timer_list connect_timer;
@@ -1130,7 +1193,9 @@ struct drbd_peer_device {
 	bool resync_susp_dependency[2];
 	bool resync_susp_other_c[2];
 	enum drbd_repl_state negotiation_result; /* To find disk state after attach */
+	unsigned long congestion_since; /* jiffies, 0: below cong_fill/cong_extents */
 	unsigned int send_cnt;
+	unsigned int send_zeroes_cnt; /* sectors of all-zero writes sent as P_ZEROES */
 	unsigned int recv_cnt;
 	atomic_t packet_seq;
 	unsigned int peer_seq;
@@ -1148,6 +1213,7 @@ struct drbd_peer_device {
 	enum drbd_repl_state start_resync_side;
 	enum drbd_repl_state last_repl_state; /* What we received from the peer */
 	struct timer_list start_resync_timer;
+	struct timer_list resume_verify_timer;
 	struct drbd_work resync_work;
 	struct timer_list resync_timer;
 	struct drbd_work propagate_uuids_work;
@@ -1179,6 +1245,14 @@ struct drbd_peer_device {
 	unsigned long rs_paused;
 	/* skipped because csum was equal [unit BM_BLOCK_SIZE] */
 	unsigned long rs_same_csum;
+	/* answered with P_RS_DEALLOCATED, read back as zeroes [unit BM_BLOCK_SIZE] */
+	unsigned long rs_deallocated;
+	struct {
+		/* checksum based resync: outcome of the current window */
+		unsigned long window_done;	/* resolved blocks at window start */
+		unsigned long window_same;	/* rs_same_csum at window start */
+		unsigned int plain_windows;	/* windows left without checksums */
+	} rs_csum_adapt;
 #define DRBD_SYNC_MARKS 8
 #define DRBD_SYNC_MARK_STEP (3*HZ)
 	/* block not up-to-date at mark [unit BM_BLOCK_SIZE] */
@@ -1194,6 +1268,10 @@ struct drbd_peer_device {
 	sector_t ov_stop_sector;
 	/* where are we now? (sector) */
 	sector_t ov_position;
+	/* for verify_gib_per_hour: start of this run [unit jiffies],
+	 * and requests sent since then [unit BM_BLOCK_SIZE] */
+	unsigned long ov_sched_start;
+	unsigned long ov_sched_sent;
 	/* Start sector of out of sync range (to merge printk reporting). */
 	sector_t ov_last_oos_start;
 	/* size of out-of-sync range in sectors. */
@@ -1210,6 +1288,25 @@ struct drbd_peer_device {
 			      * on the lower level device when we last looked. */
 	int rs_in_flight; /* resync sectors in flight (to proxy, in proxy and from proxy) */
 	ktime_t rs_last_mk_req_kt;
+	struct {
+		/* state of the latency feedback resync controller,
+		 * used instead of rs_plan_s if drbd_rs_latency_target_us is set */
+		u64 rtt_ns;		/* smoothed resync request round trip */
+		unsigned int want;	/* sectors we want in flight */
+		bool congested;		/* send buffer was half full last turn */
+		unsigned int increases;
+		unsigned int decreases;
+	} rs_lat;
+	/* resync requests sent, by size: 4KiB, 8KiB, ... 1MiB */
+#define RS_REQ_SIZE_BUCKETS 9
+	unsigned int rs_req_sizes[RS_REQ_SIZE_BUCKETS];
+	struct {
+		/* sync source: resync reads submitted on behalf of the peer */
+		sector_t next_sector;	/* end of the previous read */
+		unsigned int reads;
+		unsigned int contiguous; /* started where the previous one ended */
+		unsigned int sizes[RS_REQ_SIZE_BUCKETS];
+	} rs_src;
 	unsigned long ov_left; /* in bits */
 	unsigned long ov_skipped; /* in bits */
 	u64 rs_start_uuid;
@@ -1232,6 +1329,8 @@ struct drbd_peer_device {
 	struct dentry *debugfs_peer_dev;
 	struct dentry *debugfs_peer_dev_resync_extents;
 	struct dentry *debugfs_peer_dev_proc_drbd;
+	struct dentry *debugfs_peer_dev_resync_controller;
+	struct dentry *debugfs_peer_dev_resync_requests;
 #endif
 	ktime_t pre_send_kt;
 	ktime_t acked_kt;
@@ -1259,6 +1358,10 @@ struct opener {
 	ktime_t opened;
 };
 
+/* extents of 1 MiB, see drbd_write_may_overlap() */
+#define WRITE_SUMMARY_SHIFT 11
+#define WRITE_SUMMARY_SLOTS 256
+
 struct drbd_device {
 #ifdef PARANOIA
 	long magic;
@@ -1279,6 +1382,7 @@ struct drbd_device {
 	struct dentry *debugfs_vol_ed_gen_id;
 	struct dentry *debugfs_vol_openers;
 	struct dentry *debugfs_vol_md_io;
+	struct dentry *debugfs_vol_write_conflicts;
 #ifdef CONFIG_DRBD_TIMING_STATS
 	struct dentry *debugfs_vol_req_timing;
 #endif
@@ -1322,6 +1426,12 @@ struct drbd_device {
 	/* Interval trees of pending local requests */
 	struct rb_root read_requests;
 	struct rb_root write_requests;
+	/* per hashed extent, intervals in write_requests touching it,
+	 * see drbd_write_may_overlap() */
+	unsigned int write_summary[WRITE_SUMMARY_SLOTS];
+	unsigned int write_summary_wide;
+	unsigned long write_summary_lookups;
+	unsigned long write_summary_skipped;
 
 	/* for statistics and timeouts */
 	/* [0] read, [1] write */
@@ -1347,6 +1457,9 @@ struct drbd_device {
 	u64 next_exposed_data_uuid;
 	struct rw_semaphore uuid_sem;
 	atomic_t rs_sect_ev; /* for submitted resync data rate, both */
+	/* application I/O on the backing device, see drbd_rs_c_min_rate_throttle() */
+	unsigned long app_lat_us;	/* smoothed local completion latency */
+	unsigned long app_lat_jif;	/* last sample */
 	struct pending_bitmap_work_s {
 		atomic_t n;		/* inc when queued here, */
 		spinlock_t q_lock;	/* dec only once finished. */
@@ -1605,6 +1718,8 @@ extern bool drbd_device_stable(struct drbd_device *device, u64 *authoritative);
 extern void drbd_flush_peer_acks(struct drbd_resource *resource);
 extern void drbd_cork(struct drbd_connection *connection, enum drbd_stream stream);
 extern void drbd_uncork(struct drbd_connection *connection, enum drbd_stream stream);
+extern void drbd_cork_nested(struct drbd_connection *connection, enum drbd_stream stream);
+extern void drbd_uncork_nested(struct drbd_connection *connection, enum drbd_stream stream);
 extern void drbd_open_counts(struct drbd_resource *resource, int *rw_count_ptr, int *ro_count_ptr);
 
 extern struct drbd_connection *
@@ -1782,6 +1897,8 @@ extern sector_t      drbd_bm_capacity(struct drbd_device *device);
 
 #define DRBD_END_OF_BITMAP	(~(unsigned long)0)
 extern unsigned long drbd_bm_find_next(struct drbd_peer_device *, unsigned long);
+extern unsigned long drbd_bm_range_find_next_zero(struct drbd_peer_device *,
+						  unsigned long start, unsigned long end);
 /* bm_find_next variants for use while you hold drbd_bm_lock() */
 extern unsigned long _drbd_bm_find_next(struct drbd_peer_device *, unsigned long);
 extern unsigned long _drbd_bm_find_next_zero(struct drbd_peer_device *, unsigned long);
@@ -1941,12 +2058,18 @@ static inline void ov_skipped_print(struct drbd_peer_device *peer_device)
 
 extern void drbd_csum_bio(struct crypto_shash *, struct bio *, void *);
 extern void drbd_csum_pages(struct crypto_shash *, struct page *, void *);
+extern bool drbd_pages_all_zero(struct page *, unsigned int);
+extern bool drbd_bio_all_zero(struct bio *);
 /* worker callbacks */
 extern int w_e_end_data_req(struct drbd_work *, int);
 extern int w_e_end_rsdata_req(struct drbd_work *, int);
 extern int w_e_end_csum_rs_req(struct drbd_work *, int);
 extern int w_e_end_ov_reply(struct drbd_work *, int);
+extern void drbd_sender_uncork_control(struct drbd_connection *);
 extern int w_e_end_ov_req(struct drbd_work *, int);
+extern int drbd_create_digest_workqueue(void);
+extern void drbd_destroy_digest_workqueue(void);
+extern void drbd_flush_digest_workqueue(void);
 extern int w_resync_timer(struct drbd_work *, int);
 extern int w_send_dblock(struct drbd_work *, int);
 extern int w_send_read_req(struct drbd_work *, int);
@@ -1957,6 +2080,7 @@ extern int w_send_uuids(struct drbd_work *, int);
 
 extern void resync_timer_fn(struct timer_list *t);
 extern void start_resync_timer_fn(struct timer_list *t);
+extern void resume_verify_timer_fn(struct timer_list *t);
 
 extern void drbd_endio_write_sec_final(struct drbd_peer_request *peer_req);
 
@@ -2077,6 +2201,23 @@ static inline void drbd_submit_bio_noacct(struct drbd_device *device,
 	}
 }
 
+/* Tag resync, verify and lazy bitmap writeout bios, so that mq-deadline,
+ * BFQ or io.cost favor application I/O without help from the resync
+ * controller. IOPRIO_CLASS_NONE leaves them at the submitter's priority.
+ * Resync must never preempt application I/O, so realtime becomes
+ * best-effort. */
+static inline void drbd_set_resync_ioprio(struct bio *bio)
+{
+	unsigned int class = READ_ONCE(drbd_resync_ioprio_class);
+	unsigned int level = READ_ONCE(drbd_resync_ioprio_level);
+
+	if (class == IOPRIO_CLASS_NONE || class > IOPRIO_CLASS_IDLE)
+		return;
+	if (class == IOPRIO_CLASS_RT)
+		class = IOPRIO_CLASS_BE;
+	drbd_bio_set_ioprio(bio, IOPRIO_PRIO_VALUE(class, min_t(unsigned int, level, IOPRIO_BE_NR - 1)));
+}
+
 void drbd_bump_write_ordering(struct drbd_resource *resource, struct drbd_backing_dev *bdev,
 			      enum write_ordering_e wo);
 
@@ -2113,6 +2254,7 @@ extern int __drbd_change_sync(struct drbd_peer_device *peer_device, sector_t sec
 	__drbd_change_sync(peer_device, sector, size, SET_OUT_OF_SYNC)
 #define drbd_rs_failed_io(peer_device, sector, size) \
 	__drbd_change_sync(peer_device, sector, size, RECORD_RS_FAILED)
+extern void drbd_set_in_sync_paused_sources(struct drbd_peer_device *, sector_t, int);
 extern void drbd_al_shrink(struct drbd_device *device);
 extern bool drbd_sector_has_priority(struct drbd_peer_device *, sector_t);
 extern int drbd_al_initialize(struct drbd_device *, void *);
@@ -2403,7 +2545,8 @@ extern int drbd_send_ping(struct drbd_connection *connection);
 extern int drbd_send_ping_ack(struct drbd_connection *connection);
 extern int conn_send_state_req(struct drbd_connection *, int vnr, enum drbd_packet, union drbd_state, union drbd_state);
 extern int conn_send_twopc_request(struct drbd_connection *, int vnr, enum drbd_packet, struct p_twopc_request *);
-extern int drbd_send_peer_ack(struct drbd_connection *, struct drbd_request *);
+extern u64 drbd_peer_ack_mask(struct drbd_resource *, struct drbd_request *);
+extern int drbd_send_peer_ack(struct drbd_connection *, u64 mask, u64 dagtag);
 
 static inline void drbd_thread_stop(struct drbd_thread *thi)
 {
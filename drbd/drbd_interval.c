@@ -142,6 +142,11 @@ drbd_find_overlap(struct rb_root *root, sector_t sector, unsigned int size)
 
 	BUG_ON(!IS_ALIGNED(size, 512));
 
+	/* The root knows the highest end in the tree: sequential writes
+	 * starting behind everything in flight need no descent. */
+	if (node && sector >= interval_end(node))
+		return NULL;
+
 	while (node) {
 		struct drbd_interval *here =
 			rb_entry(node, struct drbd_interval, rb);
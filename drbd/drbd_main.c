@@ -102,6 +102,61 @@ char drbd_usermode_helper[80] = "/sbin/drbdadm";
 module_param_named(minor_count, drbd_minor_count, uint, 0444);
 module_param_string(usermode_helper, drbd_usermode_helper, sizeof(drbd_usermode_helper), 0644);
 
+/* 0: use the c-plan-ahead/c-fill-target/c-delay-target resync controller */
+unsigned int drbd_rs_latency_target_us;
+MODULE_PARM_DESC(resync_latency_target_us, "Resync request latency budget in microseconds (0 = off)");
+module_param_named(resync_latency_target_us, drbd_rs_latency_target_us, uint, 0644);
+
+/* replicate writes of all-zero data as P_ZEROES, without payload.
+ * Off by default: the peer implements P_ZEROES with a synchronous
+ * blkdev_issue_zeroout(), which blocks its receiver. */
+bool drbd_send_zeroes;
+MODULE_PARM_DESC(send_zeroes, "Send all-zero writes without payload, if the peer supports it");
+module_param_named(send_zeroes, drbd_send_zeroes, bool, 0644);
+
+/* 0: detect application I/O by comparing backing device sector counters */
+unsigned int drbd_rs_app_latency_us;
+MODULE_PARM_DESC(resync_app_latency_us, "Throttle resync while application I/O on the backing device, local or on behalf of a peer, takes longer than this, in microseconds (0 = off)");
+module_param_named(resync_app_latency_us, drbd_rs_app_latency_us, uint, 0644);
+
+/* 0: do not look for duplicate blocks in replicated writes */
+unsigned int drbd_dedup_cache_kib;
+MODULE_PARM_DESC(dedup_cache_kib, "Per connection cache of recently sent block hashes, for duplicate block statistics, in KiB (0 = off)");
+module_param_named(dedup_cache_kib, drbd_dedup_cache_kib, uint, 0644);
+
+/* 0: do not estimate delta encoding of overwrites */
+unsigned int drbd_delta_cache_kib;
+MODULE_PARM_DESC(delta_cache_kib, "Per connection cache of chunk checksums of recently sent blocks, for overwrite delta statistics with protocol A, in KiB (0 = off)");
+module_param_named(delta_cache_kib, drbd_delta_cache_kib, uint, 0644);
+
+/* see peer_ack_delay() */
+unsigned int drbd_peer_ack_idle_delay_ms = 2;
+MODULE_PARM_DESC(peer_ack_idle_delay_ms, "Send peer acks this many milliseconds after the last write completed, if no other write is in flight, instead of after peer-ack-delay (0 = always use peer-ack-delay)");
+module_param_named(peer_ack_idle_delay_ms, drbd_peer_ack_idle_delay_ms, uint, 0644);
+
+/* see drbd_set_resync_ioprio() */
+unsigned int drbd_resync_ioprio_class = IOPRIO_CLASS_NONE;
+unsigned int drbd_resync_ioprio_level = IOPRIO_BE_NR - 1;
+MODULE_PARM_DESC(resync_ioprio_class, "I/O priority class of resync and verify I/O (0 = unchanged, 2 = best-effort, 3 = idle; 1 = realtime is treated as best-effort)");
+MODULE_PARM_DESC(resync_ioprio_level, "I/O priority level within resync_ioprio_class (0 = highest, 7 = lowest)");
+module_param_named(resync_ioprio_class, drbd_resync_ioprio_class, uint, 0644);
+module_param_named(resync_ioprio_level, drbd_resync_ioprio_level, uint, 0644);
+
+/* spread online verify evenly over time, 0: as fast as the resync controller allows */
+unsigned int drbd_verify_gib_per_hour;
+MODULE_PARM_DESC(verify_gib_per_hour, "Online verify budget in GiB per hour (0 = unlimited)");
+module_param_named(verify_gib_per_hour, drbd_verify_gib_per_hour, uint, 0644);
+
+/* continue an online verify from where it stopped, once the connection is back */
+bool drbd_verify_auto_resume;
+MODULE_PARM_DESC(verify_auto_resume, "Resume online verify runs interrupted by a connection loss");
+module_param_named(verify_auto_resume, drbd_verify_auto_resume, bool, 0644);
+
+/* how long congestion may last before on-congestion pull-ahead/disconnect kicks in */
+unsigned int drbd_congestion_grace_ms;
+MODULE_PARM_DESC(congestion_grace_ms, "Keep replicating through congestion this long before pulling ahead, in milliseconds");
+module_param_named(congestion_grace_ms, drbd_congestion_grace_ms, uint, 0644);
+
 static int param_set_drbd_protocol_version(const char *s, const struct kernel_param *kp)
 {
 	unsigned long long tmp;
@@ -1107,6 +1162,7 @@ void drbd_uncork(struct drbd_connection *connection, enum drbd_stream stream)
 	mutex_lock(&connection->mutex[stream]);
 	flush_send_buffer(connection, stream);
 
+	connection->cork_count[stream] = 0;
 	clear_bit(CORKED + stream, &connection->flags);
 	/* only call into transport, if we expect it to work */
 	if (connection->cstate[NOW] >= C_CONNECTING)
@@ -1114,6 +1170,41 @@ void drbd_uncork(struct drbd_connection *connection, enum drbd_stream stream)
 	mutex_unlock(&connection->mutex[stream]);
 }
 
+/* For streams corked from more than one thread, e.g. the control stream by
+ * the ack_sender and the sender: each drbd_cork_nested() needs its own
+ * drbd_uncork_nested(), and only the last one flushes and uncorks. So one
+ * thread does not send out the batch of the other in the middle.
+ * drbd_uncork() still uncorks unconditionally, e.g. on reconnect. */
+void drbd_cork_nested(struct drbd_connection *connection, enum drbd_stream stream)
+{
+	struct drbd_transport *transport = &connection->transport;
+	struct drbd_transport_ops *tr_ops = transport->ops;
+
+	mutex_lock(&connection->mutex[stream]);
+	if (!connection->cork_count[stream]++) {
+		set_bit(CORKED + stream, &connection->flags);
+		if (connection->cstate[NOW] >= C_CONNECTING)
+			tr_ops->hint(transport, stream, CORK);
+	}
+	mutex_unlock(&connection->mutex[stream]);
+}
+
+void drbd_uncork_nested(struct drbd_connection *connection, enum drbd_stream stream)
+{
+	struct drbd_transport *transport = &connection->transport;
+	struct drbd_transport_ops *tr_ops = transport->ops;
+
+	mutex_lock(&connection->mutex[stream]);
+	/* already zero after an unconditional drbd_uncork() */
+	if (connection->cork_count[stream] && !--connection->cork_count[stream]) {
+		flush_send_buffer(connection, stream);
+		clear_bit(CORKED + stream, &connection->flags);
+		if (connection->cstate[NOW] >= C_CONNECTING)
+			tr_ops->hint(transport, stream, UNCORK);
+	}
+	mutex_unlock(&connection->mutex[stream]);
+}
+
 int send_command(struct drbd_connection *connection, int vnr,
 		 enum drbd_packet cmd, enum drbd_stream drbd_stream)
 {
@@ -1145,12 +1236,10 @@ int drbd_send_ping_ack(struct drbd_connection *connection)
 	return send_command(connection, -1, P_PING_ACK, CONTROL_STREAM);
 }
 
-int drbd_send_peer_ack(struct drbd_connection *connection,
-			      struct drbd_request *req)
+/* the nodes that have the data of @req, as announced with P_PEER_ACK */
+u64 drbd_peer_ack_mask(struct drbd_resource *resource, struct drbd_request *req)
 {
-	struct drbd_resource *resource = connection->resource;
 	struct drbd_connection *c;
-	struct p_peer_ack *p;
 	u64 mask = 0;
 
 	if (req->local_rq_state & RQ_LOCAL_OK)
@@ -1165,11 +1254,18 @@ int drbd_send_peer_ack(struct drbd_connection *connection,
 	}
 	rcu_read_unlock();
 
+	return mask;
+}
+
+int drbd_send_peer_ack(struct drbd_connection *connection, u64 mask, u64 dagtag)
+{
+	struct p_peer_ack *p;
+
 	p = conn_prepare_command(connection, sizeof(*p), CONTROL_STREAM);
 	if (!p)
 		return -EIO;
 	p->mask = cpu_to_be64(mask);
-	p->dagtag = cpu_to_be64(req->dagtag_sector);
+	p->dagtag = cpu_to_be64(dagtag);
 
 	return send_command(connection, -1, P_PEER_ACK, CONTROL_STREAM);
 }
@@ -1841,6 +1937,12 @@ static int fill_bitmap_rle_bits(struct drbd_peer_device *peer_device,
 	if (c->bit_offset >= c->bm_bits)
 		return 0; /* nothing to do. */
 
+	/* the last attempt(s) did not pay off, send plain text right away */
+	if (c->rle_skip) {
+		c->rle_skip--;
+		return 0;
+	}
+
 	/* use at most thus many bytes */
 	bitstream_init(&bs, p->code, size, 0);
 	memset(p->code, 0, size);
@@ -1892,6 +1994,12 @@ static int fill_bitmap_rle_bits(struct drbd_peer_device *peer_device,
 		toggle = !toggle;
 		plain_bits += rl;
 		c->bit_offset = tmp;
+
+		/* Half the buffer is used up, and it still does not
+		 * compress. Don't burn more cycles on this noisy chunk. */
+		len = bs.cur.b - p->code;
+		if (len > size / 2 && plain_bits < (len << 3))
+			break;
 	} while (c->bit_offset < c->bm_bits);
 
 	len = bs.cur.b - p->code + !!bs.cur.bit;
@@ -1902,12 +2010,17 @@ static int fill_bitmap_rle_bits(struct drbd_peer_device *peer_device,
 		c->bit_offset -= plain_bits;
 		bm_xfer_ctx_bit_to_word_offset(c);
 		c->bit_offset = c->word_offset * BITS_PER_LONG;
+
+		/* fragmented areas tend to be large, back off exponentially */
+		c->rle_backoff = clamp(c->rle_backoff * 2, 1U, BM_XFER_RLE_MAX_BACKOFF);
+		c->rle_skip = c->rle_backoff;
 		return 0;
 	}
 
 	/* RLE + VLI was able to compress it just fine.
 	 * update c->word_offset. */
 	bm_xfer_ctx_bit_to_word_offset(c);
+	c->rle_backoff = 0;
 
 	/* store pad_bits */
 	dcbp_set_pad_bits(p, (8 - bs.cur.bit) & 0x7);
@@ -2273,6 +2386,174 @@ static u32 bio_flags_to_wire(struct drbd_connection *connection, struct bio *bio
 	return bio->bi_opf & REQ_SYNC ? DP_RW_SYNC : 0;
 }
 
+#define DEDUP_BLOCK_SIZE 4096
+
+/* For the statistics caches of the sender, which must not recurse into
+ * IO to ourselves. */
+static void *sender_cache_alloc(size_t bytes)
+{
+	void *p = kzalloc(bytes, GFP_NOIO | __GFP_NOWARN);
+
+	if (!p)
+		p = __vmalloc(bytes, GFP_NOIO | __GFP_ZERO);
+	return p;
+}
+
+/* Replicated writes of VM images and backups carry the same 4 KiB blocks
+ * over and over. Sending a reference instead of the payload would need a
+ * new packet and feature flag; as a first step, find out how much that
+ * would save: hash each 4 KiB block of plain writes and count how many of
+ * them are in a direct mapped cache of recently sent block hashes.
+ * crc32c collisions make this overestimate the hits slightly.
+ * Only called from the sender thread, so no locking. */
+static void dedup_account(struct drbd_connection *connection, struct bio *bio)
+/* kmap compat: KM_USER1 */
+{
+	unsigned int cache_kib = READ_ONCE(drbd_dedup_cache_kib);
+	unsigned int slots = 0, fill = 0;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	u32 crc = ~0;
+
+	if (cache_kib)
+		slots = rounddown_pow_of_two(min(cache_kib, 1U << 20) * 1024 / sizeof(u32));
+	if (slots != connection->dedup.slots) {
+		size_t bytes = slots * sizeof(u32);
+
+		kvfree(connection->dedup.hashes);
+		connection->dedup.hashes = NULL;
+		/* Do not retry for every write if this fails, but only
+		 * once dedup_cache_kib changes again. */
+		connection->dedup.slots = slots;
+		if (slots)
+			connection->dedup.hashes = sender_cache_alloc(bytes);
+	}
+	if (!connection->dedup.hashes)
+		return;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		unsigned int off = 0;
+		u8 *src;
+
+		src = kmap_atomic(bvec.bv_page);
+		while (off < bvec.bv_len) {
+			unsigned int l = min(bvec.bv_len - off, DEDUP_BLOCK_SIZE - fill);
+			u32 *slot;
+
+			crc = crc32c(crc, src + bvec.bv_offset + off, l);
+			off += l;
+			fill += l;
+			if (fill < DEDUP_BLOCK_SIZE)
+				continue;
+
+			slot = &connection->dedup.hashes[crc & (slots - 1)];
+			connection->dedup.blocks++;
+			if (*slot == crc)
+				connection->dedup.hits++;
+			else
+				*slot = crc;
+			crc = ~0;
+			fill = 0;
+		}
+		kunmap_atomic(src);
+	}
+}
+
+/* Database page writes often change a few bytes of a block only. Sending
+ * an XOR delta against the previous content would need that content on
+ * both sides and a new packet; as a first step, estimate what it would
+ * save. Remember crc32c checksums of the DELTA_CHUNK sized pieces of
+ * recently written 4 KiB blocks, indexed by block number, and count the
+ * chunks that changed when a block is written again.
+ * Only called from the sender thread, so no locking. */
+#define DELTA_CHUNK 64
+
+struct delta_entry {
+	sector_t sector;	/* + 1, a zeroed entry matches nothing */
+	u32 crc[DEDUP_BLOCK_SIZE / DELTA_CHUNK];
+};
+
+static void delta_account(struct drbd_connection *connection, struct bio *bio)
+/* kmap compat: KM_USER1 */
+{
+	unsigned int cache_kib = READ_ONCE(drbd_delta_cache_kib);
+	unsigned int entries = 0, fill = 0;
+	sector_t sector = bio->bi_iter.bi_sector;
+	struct delta_entry *e = NULL;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	bool hit = false;
+	u32 crc = ~0;
+
+	if (cache_kib)
+		entries = min(cache_kib, 1U << 20) * 1024 / sizeof(struct delta_entry);
+	if (entries != connection->delta.entries) {
+		kvfree(connection->delta.cache);
+		connection->delta.cache = NULL;
+		/* as in dedup_account() */
+		connection->delta.entries = entries;
+		if (entries)
+			connection->delta.cache = sender_cache_alloc(entries * sizeof(struct delta_entry));
+	}
+	if (!connection->delta.cache)
+		return;
+	if (sector & (DEDUP_BLOCK_SIZE / 512 - 1) ||
+	    bio->bi_iter.bi_size & (DEDUP_BLOCK_SIZE - 1))
+		return;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		unsigned int off = 0;
+		u8 *src;
+
+		src = kmap_atomic(bvec.bv_page);
+		while (off < bvec.bv_len) {
+			unsigned int l = min(bvec.bv_len - off, DELTA_CHUNK - fill % DELTA_CHUNK);
+			unsigned int c;
+
+			if (fill == 0) {
+				u64 block = sector / (DEDUP_BLOCK_SIZE / 512);
+
+				e = &connection->delta.cache[do_div(block, entries)];
+				hit = e->sector == sector + 1;
+				e->sector = sector + 1;
+				connection->delta.blocks++;
+				if (hit)
+					connection->delta.hits++;
+			}
+
+			crc = crc32c(crc, src + bvec.bv_offset + off, l);
+			off += l;
+			fill += l;
+			if (fill % DELTA_CHUNK)
+				continue;
+
+			c = fill / DELTA_CHUNK - 1;
+			if (hit && e->crc[c] != crc)
+				connection->delta.changed_bytes += DELTA_CHUNK;
+			e->crc[c] = crc;
+			crc = ~0;
+			if (fill == DEDUP_BLOCK_SIZE) {
+				sector += DEDUP_BLOCK_SIZE / 512;
+				fill = 0;
+			}
+		}
+		kunmap_atomic(src);
+	}
+}
+
+/* The senders of several connections may race here; they all come to the
+ * same conclusion, so whoever stores the result first does not matter. */
+static bool req_all_zero(struct drbd_request *req)
+{
+	u8 all_zero = READ_ONCE(req->all_zero);
+
+	if (!all_zero) {
+		all_zero = drbd_bio_all_zero(req->master_bio) ? 1 : 2;
+		WRITE_ONCE(req->all_zero, all_zero);
+	}
+	return all_zero == 1;
+}
+
 /* Used to send write or TRIM aka REQ_OP_DISCARD requests
  * R_PRIMARY -> Peer	(P_DATA, P_TRIM)
  */
@@ -2290,8 +2571,17 @@ int drbd_send_dblock(struct drbd_peer_device *peer_device, struct drbd_request *
 	int err;
 	const unsigned s = drbd_req_state_by_peer_device(req, peer_device);
 	const int op = bio_op(req->master_bio);
+	bool zeroes = false;
+
+	/* Plain writes of zeroes go out as P_ZEROES, without DP_DISCARD, so
+	 * the peer writes zeroes but does not unmap. Leave FUA and flushes
+	 * alone, the peer implements P_ZEROES with blkdev_issue_zeroout(). */
+	if (op == REQ_OP_WRITE && drbd_send_zeroes &&
+	    peer_device->connection->agreed_features & DRBD_FF_WZEROES &&
+	    !(req->master_bio->bi_opf & (REQ_FUA | REQ_PREFLUSH)))
+		zeroes = req_all_zero(req);
 
-	if (op == REQ_OP_DISCARD || op == REQ_OP_WRITE_ZEROES) {
+	if (op == REQ_OP_DISCARD || op == REQ_OP_WRITE_ZEROES || zeroes) {
 		trim = drbd_prepare_command(peer_device, sizeof(*trim), DATA_STREAM);
 		if (!trim)
 			return -EIO;
@@ -2320,6 +2610,10 @@ int drbd_send_dblock(struct drbd_peer_device *peer_device, struct drbd_request *
 	p->block_id = (unsigned long)req;
 	p->seq_num = cpu_to_be32(atomic_inc_return(&peer_device->packet_seq));
 	dp_flags = bio_flags_to_wire(peer_device->connection, req->master_bio);
+	if (zeroes) {
+		dp_flags |= DP_ZEROES;
+		peer_device->send_zeroes_cnt += req->i.size >> 9;
+	}
 	if (peer_device->repl_state[NOW] >= L_SYNC_SOURCE && peer_device->repl_state[NOW] <= L_PAUSED_SYNC_T)
 		dp_flags |= DP_MAY_SET_IN_SYNC;
 	if (peer_device->connection->agreed_pro_version >= 100) {
@@ -2347,6 +2641,11 @@ int drbd_send_dblock(struct drbd_peer_device *peer_device, struct drbd_request *
 					bio_iovec(req->master_bio).bv_len);
 		err = __send_command(peer_device->connection, device->vnr, P_WSAME, DATA_STREAM);
 	} else {
+		if (op == REQ_OP_WRITE) {
+			dedup_account(peer_device->connection, req->master_bio);
+			if (!(s & (RQ_EXP_RECEIVE_ACK | RQ_EXP_WRITE_ACK)))
+				delta_account(peer_device->connection, req->master_bio);
+		}
 		additional_size_command(peer_device->connection, DATA_STREAM, req->i.size);
 		err = __send_command(peer_device->connection, device->vnr, P_DATA, DATA_STREAM);
 	}
@@ -3103,6 +3402,7 @@ static void drbd_cleanup(void)
 
 	if (retry.wq)
 		destroy_workqueue(retry.wq);
+	drbd_destroy_digest_workqueue();
 
 	drbd_genl_unregister();
 	drbd_debugfs_cleanup();
@@ -3547,6 +3847,8 @@ void drbd_destroy_connection(struct kref *kref)
 	idr_destroy(&connection->peer_devices);
 
 	kfree(connection->transport.net_conf);
+	kvfree(connection->dedup.hashes);
+	kvfree(connection->delta.cache);
 	kref_debug_destroy(&connection->kref_debug);
 	kfree(connection);
 	kref_debug_put(&resource->kref_debug, 3);
@@ -3575,6 +3877,7 @@ struct drbd_peer_device *create_peer_device(struct drbd_device *device, struct d
 	}
 
 	timer_setup(&peer_device->start_resync_timer, start_resync_timer_fn, 0);
+	timer_setup(&peer_device->resume_verify_timer, resume_verify_timer_fn, 0);
 
 	INIT_LIST_HEAD(&peer_device->resync_work.list);
 	peer_device->resync_work.cb  = w_resync_timer;
@@ -4014,6 +4317,11 @@ static int __init drbd_init(void)
 	spin_lock_init(&retry.lock);
 	INIT_LIST_HEAD(&retry.writes);
 
+	if (drbd_create_digest_workqueue()) {
+		pr_err("unable to create verify digest workqueue\n");
+		goto fail;
+	}
+
 	drbd_debugfs_init();
 
 	pr_info("initialized. "
@@ -4219,6 +4219,7 @@ static int adm_new_connection(struct drbd_connection **ret_conn,
 			}
 		}
 		peer_device->send_cnt = 0;
+		peer_device->send_zeroes_cnt = 0;
 		peer_device->recv_cnt = 0;
 	}
 
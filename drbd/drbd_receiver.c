@@ -1272,6 +1272,15 @@ static void submit_one_flush(struct drbd_device *device, struct issue_flush_cont
 	submit_bio(bio);
 }
 
+/* Without a volatile write cache, e.g. on power-loss protected NVMe, the
+ * writes of an epoch are stable once they completed, and the block layer
+ * would complete the flush right away. Checked for every epoch, so we
+ * flush again as soon as the backing queue reports a volatile cache. */
+static bool backing_cache_is_volatile(struct drbd_device *device)
+{
+	return drbd_bdev_write_cache(device->ldev->backing_bdev);
+}
+
 static enum finish_epoch drbd_flush_after_epoch(struct drbd_connection *connection, struct drbd_epoch *epoch)
 {
 	struct drbd_resource *resource = connection->resource;
@@ -1289,6 +1298,10 @@ static enum finish_epoch drbd_flush_after_epoch(struct drbd_connection *connecti
 		idr_for_each_entry(&resource->devices, device, vnr) {
 			if (!get_ldev(device))
 				continue;
+			if (!backing_cache_is_volatile(device)) {
+				put_ldev(device);
+				continue;
+			}
 			kref_get(&device->kref);
 			kref_debug_get(&device->kref_debug, 7);
 			rcu_read_unlock();
@@ -1824,6 +1837,8 @@ next_bio:
 	bio->bi_opf = peer_req->opf;
 	bio->bi_private = peer_req;
 	bio->bi_end_io = drbd_peer_request_endio;
+	if (!(peer_req->flags & EE_APPLICATION))
+		drbd_set_resync_ioprio(bio);
 
 	bio->bi_next = bios;
 	bios = bio;
@@ -1873,6 +1888,8 @@ next_bio:
 	/* for debugfs: update timestamp, mark as submitted */
 	peer_req->submit_jif = jiffies;
 	peer_req->flags |= EE_SUBMITTED;
+	if (peer_req->flags & EE_APPLICATION && READ_ONCE(drbd_rs_app_latency_us))
+		peer_req->submit_kt = ktime_get();
 	do {
 		bio = bios;
 		bios = bios->bi_next;
@@ -1901,7 +1918,7 @@ static void drbd_remove_peer_req_interval(struct drbd_device *device,
 {
 	struct drbd_interval *i = &peer_req->i;
 
-	drbd_remove_interval(&device->write_requests, i);
+	drbd_remove_write_interval(device, i);
 	drbd_clear_interval(i);
 	peer_req->flags &= ~EE_IN_INTERVAL_TREE;
 
@@ -2253,6 +2270,7 @@ static int e_end_resync_block(struct drbd_work *w, int unused)
 
 	if (likely((peer_req->flags & EE_WAS_ERROR) == 0)) {
 		drbd_set_in_sync(peer_device, sector, peer_req->i.size);
+		drbd_set_in_sync_paused_sources(peer_device, sector, peer_req->i.size);
 		err = drbd_send_ack(peer_device, P_RS_WRITE_ACK, peer_req);
 	} else {
 		/* Record failure to sync */
@@ -2775,6 +2793,7 @@ static int handle_write_conflicts(struct drbd_peer_request *peer_req)
 	bool resolve_conflicts = test_bit(RESOLVE_CONFLICTS, &connection->transport.flags);
 	sector_t sector = peer_req->i.sector;
 	const unsigned int size = peer_req->i.size;
+	bool may_overlap = drbd_write_may_overlap(device, sector, size);
 	struct drbd_interval *i;
 	bool equal;
 	int err;
@@ -2783,8 +2802,10 @@ static int handle_write_conflicts(struct drbd_peer_request *peer_req)
 	 * Inserting the peer request into the write_requests tree will prevent
 	 * new conflicting local requests from being added.
 	 */
-	drbd_insert_interval(&device->write_requests, &peer_req->i);
+	drbd_insert_write_interval(device, &peer_req->i);
 	peer_req->flags |= EE_IN_INTERVAL_TREE;
+	if (!may_overlap)
+		return 0;
 
     repeat:
 	drbd_for_each_overlap(i, &device->write_requests, sector, size) {
@@ -3287,51 +3308,71 @@ bool drbd_rs_should_slow_down(struct drbd_peer_device *peer_device, sector_t sec
 	return !drbd_sector_has_priority(peer_device, sector);
 }
 
+/* Is application I/O on the backing device currently slower than allowed?
+ * Samples older than a second mean there is no application I/O to protect. */
+static bool app_latency_exceeded(struct drbd_device *device, unsigned int latency_us)
+{
+	unsigned long last = READ_ONCE(device->app_lat_jif);
+
+	if (!last || time_after(jiffies, last + HZ))
+		return false;
+	return READ_ONCE(device->app_lat_us) > latency_us;
+}
+
 bool drbd_rs_c_min_rate_throttle(struct drbd_peer_device *peer_device)
 {
 	struct drbd_device *device = peer_device->device;
 	struct hd_struct *part = &device->ldev->backing_bdev->bd_contains->bd_disk->part0;
 	unsigned long db, dt, dbdt;
-	unsigned int c_min_rate;
+	unsigned int c_min_rate, latency_us;
+	unsigned long rs_left;
 	int curr_events;
+	int i;
 
 	rcu_read_lock();
 	c_min_rate = rcu_dereference(peer_device->conf)->c_min_rate;
 	rcu_read_unlock();
+	latency_us = READ_ONCE(drbd_rs_app_latency_us);
 
 	/* feature disabled? */
 	if (c_min_rate == 0)
 		return false;
 
-	curr_events = (int)part_stat_read(part, sectors[0])
-		+ (int)part_stat_read(part, sectors[1])
-		- atomic_read(&device->rs_sect_ev);
+	if (latency_us) {
+		/* Throttle while application requests miss their latency
+		 * target, down to c_min_rate. That works on shared and
+		 * virtualized disks, where sector counters do not tell
+		 * whose I/O is whose. */
+		if (!app_latency_exceeded(device, latency_us))
+			return false;
+	} else {
+		curr_events = (int)part_stat_read(part, sectors[0])
+			+ (int)part_stat_read(part, sectors[1])
+			- atomic_read(&device->rs_sect_ev);
 
-	if (atomic_read(&device->ap_actlog_cnt) || curr_events - peer_device->rs_last_events > 64) {
-		unsigned long rs_left;
-		int i;
+		if (!atomic_read(&device->ap_actlog_cnt) &&
+		    curr_events - peer_device->rs_last_events <= 64)
+			return false;
 
 		peer_device->rs_last_events = curr_events;
+	}
 
-		/* sync speed average over the last 2*DRBD_SYNC_MARK_STEP,
-		 * approx. */
-		i = (peer_device->rs_last_mark + DRBD_SYNC_MARKS-1) % DRBD_SYNC_MARKS;
+	/* sync speed average over the last 2*DRBD_SYNC_MARK_STEP,
+	 * approx. */
+	i = (peer_device->rs_last_mark + DRBD_SYNC_MARKS-1) % DRBD_SYNC_MARKS;
 
-		if (peer_device->repl_state[NOW] == L_VERIFY_S || peer_device->repl_state[NOW] == L_VERIFY_T)
-			rs_left = peer_device->ov_left;
-		else
-			rs_left = drbd_bm_total_weight(peer_device) - peer_device->rs_failed;
+	if (peer_device->repl_state[NOW] == L_VERIFY_S || peer_device->repl_state[NOW] == L_VERIFY_T)
+		rs_left = peer_device->ov_left;
+	else
+		rs_left = drbd_bm_total_weight(peer_device) - peer_device->rs_failed;
 
-		dt = ((long)jiffies - (long)peer_device->rs_mark_time[i]) / HZ;
-		if (!dt)
-			dt++;
-		db = peer_device->rs_mark_left[i] - rs_left;
-		dbdt = Bit2KB(db/dt);
+	dt = ((long)jiffies - (long)peer_device->rs_mark_time[i]) / HZ;
+	if (!dt)
+		dt++;
+	db = peer_device->rs_mark_left[i] - rs_left;
+	dbdt = Bit2KB(db/dt);
 
-		if (dbdt > c_min_rate)
-			return true;
-	}
-	return false;
+	return dbdt > c_min_rate;
 }
 
 static void verify_skipped_block(struct drbd_peer_device *peer_device,
@@ -3348,6 +3389,22 @@ static void verify_skipped_block(struct drbd_peer_device *peer_device,
 	verify_progress(peer_device, sector, size);
 }
 
+/* Resync reads arriving back to back are submitted under the receiver's
+ * plug (see drbd_recv_header_maybe_unplug()), which lets the block layer
+ * merge adjacent ones into larger requests. Count how often that is
+ * possible, and how large the requests are to begin with. */
+static void rs_src_read_accounting(struct drbd_peer_device *peer_device,
+				   sector_t sector, unsigned int size)
+{
+	if (sector == peer_device->rs_src.next_sector)
+		peer_device->rs_src.contiguous++;
+	peer_device->rs_src.next_sector = sector + (size >> 9);
+	peer_device->rs_src.reads++;
+	peer_device->rs_src.sizes[min_t(unsigned int,
+					ilog2(DIV_ROUND_UP(size, BM_BLOCK_SIZE)),
+					RS_REQ_SIZE_BUCKETS - 1)]++;
+}
+
 static int receive_DataRequest(struct drbd_connection *connection, struct packet_info *pi)
 {
 	struct drbd_peer_device *peer_device;
@@ -3487,7 +3544,13 @@ static int receive_DataRequest(struct drbd_connection *connection, struct packet
 		/* If at some point in the future we have a smart way to
 		   find out if this data block is completely deallocated,
 		   then we would do something smarter here than reading
-		   the block... */
+		   the block...
+		   There is no interface to ask a block device (dm-thin,
+		   loop on a sparse file) for its allocation state. dm-thin
+		   at least answers reads of unprovisioned blocks with
+		   zeroes without touching its data device, so the read
+		   is cheap exactly where it is useless.
+		   See rs_deallocated in debugfs resync_requests. */
 		peer_req->flags |= EE_RS_THIN_REQ;
 		fallthrough;
 	case P_RS_DATA_REQUEST:
@@ -3607,6 +3670,9 @@ static int receive_DataRequest(struct drbd_connection *connection, struct packet
 		}
 	}
 
+	if (pi->cmd != P_OV_REQUEST)
+		rs_src_read_accounting(peer_device, sector, size);
+
 submit_for_resync:
 	atomic_add(size >> 9, &device->rs_sect_ev);
 
@@ -7574,6 +7640,56 @@ static int dcbp_get_pad_bits(struct p_compressed_bm *p)
 	return (p->encoding >> 4) & 0x7;
 }
 
+/* Fragmented areas of the bitmap decode into many short runs.  Instead of
+ * taking the bm_lock for each of them, collect short runs in a small
+ * window of little endian words and merge that in one go. */
+#define BM_RLE_WINDOW_WORDS 32
+#define BM_RLE_WINDOW_BITS (BM_RLE_WINDOW_WORDS * BITS_PER_LONG)
+
+struct bm_rle_window {
+	unsigned long start;	/* first bit, long word aligned */
+	bool dirty;
+	unsigned long buf[BM_RLE_WINDOW_WORDS];
+};
+
+static void bm_rle_window_flush(struct drbd_peer_device *peer_device,
+				struct bm_rle_window *w, struct bm_xfer_ctx *c)
+{
+	unsigned long word = w->start / BITS_PER_LONG;
+
+	if (!w->dirty)
+		return;
+	drbd_bm_merge_lel(peer_device, word,
+			  min_t(unsigned long, BM_RLE_WINDOW_WORDS, c->bm_words - word),
+			  w->buf);
+	w->dirty = false;
+}
+
+static void bm_rle_window_set(struct drbd_peer_device *peer_device,
+			      struct bm_rle_window *w, struct bm_xfer_ctx *c,
+			      unsigned long s, unsigned long e)
+{
+	if (e - s >= BITS_PER_LONG) {
+		/* long runs are cheap enough by themselves */
+		drbd_bm_set_many_bits(peer_device, s, e);
+		return;
+	}
+
+	if (!w->dirty || s < w->start || e >= w->start + BM_RLE_WINDOW_BITS) {
+		bm_rle_window_flush(peer_device, w, c);
+		w->start = s & ~(BITS_PER_LONG - 1UL);
+		if (e >= w->start + BM_RLE_WINDOW_BITS) {
+			drbd_bm_set_many_bits(peer_device, s, e);
+			return;
+		}
+		memset(w->buf, 0, sizeof(w->buf));
+		w->dirty = true;
+	}
+
+	for (; s <= e; s++)
+		__set_bit_le(s - w->start, w->buf);
+}
+
 /**
  * recv_bm_rle_bits
  *
@@ -7593,6 +7709,7 @@ recv_bm_rle_bits(struct drbd_peer_device *peer_device,
 	unsigned long s = c->bit_offset;
 	unsigned long e;
 	int toggle = dcbp_get_start(p);
+	struct bm_rle_window w = { .dirty = false };
 	int have;
 	int bits;
 
@@ -7613,7 +7730,7 @@ recv_bm_rle_bits(struct drbd_peer_device *peer_device,
 				drbd_err(peer_device, "bitmap overflow (e:%lu) while decoding bm RLE packet\n", e);
 				return -EIO;
 			}
-			drbd_bm_set_many_bits(peer_device, s, e);
+			bm_rle_window_set(peer_device, &w, c, s, e);
 		}
 
 		if (have < bits) {
@@ -7636,6 +7753,7 @@ recv_bm_rle_bits(struct drbd_peer_device *peer_device,
 		look_ahead |= tmp << have;
 		have += bits;
 	}
+	bm_rle_window_flush(peer_device, &w, c);
 
 	c->bit_offset = s;
 	bm_xfer_ctx_bit_to_word_offset(c);
@@ -8284,6 +8402,7 @@ static void cleanup_resync_leftovers(struct drbd_peer_device *peer_device)
 	del_timer_sync(&peer_device->resync_timer);
 	resync_timer_fn(&peer_device->resync_timer);
 	del_timer_sync(&peer_device->start_resync_timer);
+	del_timer_sync(&peer_device->resume_verify_timer);
 }
 
 static void drain_resync_activity(struct drbd_connection *connection)
@@ -8452,6 +8571,7 @@ static void conn_disconnect(struct drbd_connection *connection)
 	/* wait for all w_e_end_data_req, w_e_end_rsdata_req, w_send_barrier,
 	 * w_make_resync_request etc. which may still be on the worker queue
 	 * to be "canceled" */
+	drbd_flush_digest_workqueue();
 	drbd_flush_workqueue(&connection->sender_work);
 
 	drbd_finish_peer_reqs(connection);
@@ -8873,10 +8993,15 @@ int drbd_receiver(struct drbd_thread *thi)
 
 /* ********* acknowledge sender ******** */
 
+/* A P_PEER_ACK covers all peer requests up to its dagtag. So of a run of
+ * queued peer acks with the same mask, only the last one needs to be sent.
+ * Such runs are common: peer_ack_differs() also looks at nodes we are not
+ * connected to, and a full window or the activity log end a batch early. */
 static int process_peer_ack_list(struct drbd_connection *connection)
 {
 	struct drbd_resource *resource = connection->resource;
-	struct drbd_request *req, *tmp;
+	struct drbd_request *req, *pending = NULL;
+	u64 mask, pending_mask = 0;
 	unsigned int idx;
 	int err = 0;
 
@@ -8890,16 +9015,32 @@ static int process_peer_ack_list(struct drbd_connection *connection)
 			continue;
 		}
 		req->net_rq_state[idx] &= ~RQ_PEER_ACK;
-		spin_unlock_irq(&resource->req_lock);
-
-		err = drbd_send_peer_ack(connection, req);
+		mask = drbd_peer_ack_mask(resource, req);
 
-		spin_lock_irq(&resource->req_lock);
-		tmp = list_next_entry(req, tl_requests);
-		kref_put(&req->kref, destroy_peer_ack_req);
+		if (pending && mask == pending_mask) {
+			connection->peer_acks_merged++;
+		} else if (pending) {
+			spin_unlock_irq(&resource->req_lock);
+			err = drbd_send_peer_ack(connection, pending_mask, pending->dagtag_sector);
+			spin_lock_irq(&resource->req_lock);
+			connection->peer_acks_sent++;
+		}
+		if (pending)
+			kref_put(&pending->kref, destroy_peer_ack_req);
+		pending = req;
+		pending_mask = mask;
 		if (err)
 			break;
-		req = tmp;
+		req = list_next_entry(req, tl_requests);
+	}
+	if (pending) {
+		if (!err) {
+			spin_unlock_irq(&resource->req_lock);
+			err = drbd_send_peer_ack(connection, pending_mask, pending->dagtag_sector);
+			spin_lock_irq(&resource->req_lock);
+			connection->peer_acks_sent++;
+		}
+		kref_put(&pending->kref, destroy_peer_ack_req);
 	}
 	spin_unlock_irq(&resource->req_lock);
 	return err;
@@ -9084,6 +9225,7 @@ static int got_IsInSync(struct drbd_connection *connection, struct packet_info *
 	if (get_ldev(device)) {
 		drbd_rs_complete_io(peer_device, sector);
 		drbd_set_in_sync(peer_device, sector, blksize);
+		drbd_set_in_sync_paused_sources(peer_device, sector, blksize);
 		/* rs_same_csums is supposed to count in units of BM_BLOCK_SIZE */
 		peer_device->rs_same_csum += (blksize >> BM_BLOCK_SHIFT);
 		put_ldev(device);
@@ -9757,12 +9899,12 @@ void drbd_send_acks_wf(struct work_struct *ws)
 	/* TODO: conditionally cork; it may hurt latency if we cork without
 	   much to send */
 	if (tcp_cork)
-		drbd_cork(connection, CONTROL_STREAM);
+		drbd_cork_nested(connection, CONTROL_STREAM);
 	err = drbd_finish_peer_reqs(connection);
 
 	/* but unconditionally uncork unless disabled */
 	if (tcp_cork)
-		drbd_uncork(connection, CONTROL_STREAM);
+		drbd_uncork_nested(connection, CONTROL_STREAM);
 
 	if (err)
 		change_cstate(connection, C_NETWORK_FAILURE, CS_HARD);
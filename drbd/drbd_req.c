@@ -106,6 +106,32 @@ static bool peer_ack_differs(struct drbd_request *req1, struct drbd_request *req
 	return false;
 }
 
+/* Batching peer acks pays off while more writes are coming. With no other
+ * write in flight, do not keep the peers waiting for the full peer-ack-delay
+ * to drop this request from their lists, only long enough to catch the
+ * rest of a burst. */
+static unsigned long peer_ack_delay(struct drbd_resource *resource)
+{
+	unsigned long delay = resource->res_opts.peer_ack_delay * HZ / 1000;
+	unsigned int idle_ms = READ_ONCE(drbd_peer_ack_idle_delay_ms);
+	struct drbd_device *device;
+	int vnr;
+
+	if (!idle_ms)
+		return delay;
+
+	rcu_read_lock();
+	idr_for_each_entry(&resource->devices, device, vnr) {
+		if (atomic_read(&device->ap_bio_cnt[WRITE])) {
+			rcu_read_unlock();
+			return delay;
+		}
+	}
+	rcu_read_unlock();
+
+	return min(delay, msecs_to_jiffies(idle_ms));
+}
+
 static bool peer_ack_window_full(struct drbd_request *req)
 {
 	struct drbd_resource *resource = req->device->resource;
@@ -115,13 +141,86 @@ static bool peer_ack_window_full(struct drbd_request *req)
 	return dagtag_newer_eq(req->dagtag_sector, last_dagtag);
 }
 
+/* Almost no write overlaps another one in flight. Summarize the
+ * write_requests tree in counters per hashed extent, so that most
+ * conflict checks can tell "no overlap" without descending the tree.
+ * An interval counts in the slot of each extent it touches, an empty one
+ * in that of its start sector: it still overlaps ranges around it, see
+ * drbd_find_overlap(). Intervals spanning many extents only count as
+ * "wide", which makes every check fall back to the tree.
+ * All of this is called within req_lock. */
+#define WRITE_SUMMARY_MAX_EXTENTS 16
+
+static bool write_summary_range(sector_t sector, unsigned int size,
+				sector_t *first, sector_t *last)
+{
+	*first = sector >> WRITE_SUMMARY_SHIFT;
+	*last = (sector + max(size >> 9, 1U) - 1) >> WRITE_SUMMARY_SHIFT;
+	return *last - *first < WRITE_SUMMARY_MAX_EXTENTS;
+}
+
+static void write_summary_account(struct drbd_device *device, struct drbd_interval *i, bool add)
+{
+	sector_t first, last;
+
+	if (!write_summary_range(i->sector, i->size, &first, &last)) {
+		if (add)
+			device->write_summary_wide++;
+		else
+			device->write_summary_wide--;
+		return;
+	}
+	for (; first <= last; first++) {
+		unsigned int *slot = &device->write_summary[first & (WRITE_SUMMARY_SLOTS - 1)];
+
+		if (add)
+			(*slot)++;
+		else
+			(*slot)--;
+	}
+}
+
+void drbd_insert_write_interval(struct drbd_device *device, struct drbd_interval *i)
+{
+	if (drbd_insert_interval(&device->write_requests, i))
+		write_summary_account(device, i, true);
+}
+
+void drbd_remove_write_interval(struct drbd_device *device, struct drbd_interval *i)
+{
+	if (drbd_interval_empty(i))
+		return;
+	drbd_remove_interval(&device->write_requests, i);
+	write_summary_account(device, i, false);
+}
+
+/* false: definitely nothing in write_requests overlaps [sector, sector + size) */
+bool drbd_write_may_overlap(struct drbd_device *device, sector_t sector, unsigned int size)
+{
+	sector_t first, last;
+
+	device->write_summary_lookups++;
+	if (device->write_summary_wide ||
+	    !write_summary_range(sector, size, &first, &last))
+		return true;
+	for (; first <= last; first++) {
+		if (device->write_summary[first & (WRITE_SUMMARY_SLOTS - 1)])
+			return true;
+	}
+	device->write_summary_skipped++;
+	return false;
+}
+
 static void drbd_remove_request_interval(struct rb_root *root,
 					 struct drbd_request *req)
 {
 	struct drbd_device *device = req->device;
 	struct drbd_interval *i = &req->i;
 
-	drbd_remove_interval(root, i);
+	if (root == &device->write_requests)
+		drbd_remove_write_interval(device, i);
+	else
+		drbd_remove_interval(root, i);
 
 	/* Wake up any processes waiting for this request to complete.  */
 	if (i->waiting)
@@ -274,8 +373,7 @@ void drbd_req_destroy(struct kref *kref)
 		}
 		req->device = NULL;
 		resource->peer_ack_req = req;
-		mod_timer(&resource->peer_ack_timer,
-			  jiffies + resource->res_opts.peer_ack_delay * HZ / 1000);
+		mod_timer(&resource->peer_ack_timer, jiffies + peer_ack_delay(resource));
 
 		if (!peer_ack_req)
 			resource->last_peer_acked_dagtag = req->dagtag_sector;
@@ -585,6 +683,84 @@ static unsigned int req_payload_sectors(struct drbd_request *req)
 	return req->i.size >> 9;
 }
 
+/* Smoothed rate at which the peer acknowledges application writes.
+ * A sample spans at least HZ/4; a longer gap means the link was idle,
+ * which tells nothing about its throughput, so it only restarts sampling.
+ * Called within req_lock. */
+static void ahead_drain_accounting(struct drbd_connection *connection, unsigned int sectors)
+{
+	unsigned long now = jiffies;
+	unsigned long dt = now - connection->ahead.mark_jif;
+	unsigned int rate;
+
+	connection->ahead.mark_sect += sectors;
+	if (dt < HZ / 4)
+		return;
+	if (dt <= 2 * HZ) {
+		rate = div_u64((u64)connection->ahead.mark_sect * HZ / 2, dt);
+		connection->ahead.rate = connection->ahead.rate ?
+			(connection->ahead.rate * 7 + rate) / 8 : rate;
+	}
+	connection->ahead.mark_jif = now;
+	connection->ahead.mark_sect = 0;
+}
+
+/* Going Ahead -> SyncSource right after the in-flight data drained, only
+ * to be congested again by the resync plus application writes, turns a
+ * fluctuating link into a series of resyncs. Each time we pull ahead
+ * again within AHEAD_FLAP_WINDOW of going back, double the time we stay
+ * Ahead at least; each time we do not, halve it again. */
+#define AHEAD_HOLD_MIN_MS 1000
+#define AHEAD_HOLD_MAX_MS 64000
+#define AHEAD_FLAP_WINDOW (60 * HZ)
+
+static void ahead_note_pulled_ahead(struct drbd_connection *connection)
+{
+	unsigned int hold_ms = max_t(unsigned int, connection->ahead.hold_ms, AHEAD_HOLD_MIN_MS);
+	unsigned long now = jiffies;
+
+	connection->ahead.entered++;
+	if (connection->ahead.left &&
+	    time_before(now, connection->ahead.left + AHEAD_FLAP_WINDOW)) {
+		connection->ahead.flaps++;
+		hold_ms = min_t(unsigned int, hold_ms * 2, AHEAD_HOLD_MAX_MS);
+	} else {
+		hold_ms = max_t(unsigned int, hold_ms / 2, AHEAD_HOLD_MIN_MS);
+	}
+	connection->ahead.hold_ms = hold_ms;
+	connection->ahead.since = now;
+}
+
+/* Count pulling ahead once per connection, when the first of its volumes
+ * actually went Ahead, not for failed or raced state changes.
+ * Called within rcu_read_lock(). */
+static bool first_volume_ahead(struct drbd_connection *connection,
+			       struct drbd_peer_device *ahead)
+{
+	struct drbd_peer_device *peer_device;
+	int vnr;
+
+	if (ahead->repl_state[NOW] != L_AHEAD)
+		return false;
+	idr_for_each_entry(&connection->peer_devices, peer_device, vnr) {
+		if (peer_device != ahead && peer_device->repl_state[NOW] == L_AHEAD)
+			return false;
+	}
+	return true;
+}
+
+/* in jiffies, how long to wait before going Ahead -> SyncSource */
+static unsigned long ahead_return_delay(struct drbd_connection *connection)
+{
+	unsigned int hold_ms = max_t(unsigned int, connection->ahead.hold_ms, AHEAD_HOLD_MIN_MS);
+	unsigned long hold_until = connection->ahead.since + msecs_to_jiffies(hold_ms);
+	unsigned long now = jiffies;
+
+	if (time_before(now + HZ, hold_until))
+		return hold_until - now;
+	return HZ;
+}
+
 /* I'd like this to be the only place that manipulates
  * req->completion_ref and req->kref. */
 static void mod_rq_state(struct drbd_request *req, struct bio_and_error *m,
@@ -694,14 +870,17 @@ static void mod_rq_state(struct drbd_request *req, struct bio_and_error *m,
 	if (!(old_net & RQ_NET_DONE) && (set & RQ_NET_DONE)) {
 		atomic_t *ap_in_flight = &peer_device->connection->ap_in_flight;
 
-		if (old_net & RQ_NET_SENT)
+		if (old_net & RQ_NET_SENT) {
 			atomic_sub(req_payload_sectors(req), ap_in_flight);
+			ahead_drain_accounting(peer_device->connection, req_payload_sectors(req));
+		}
 		if (old_net & RQ_EXP_BARR_ACK)
 			kref_put(&req->kref, drbd_req_destroy);
 		ktime_get_accounting(req->net_done_kt[peer_device->node_id]);
 
 		if (peer_device->repl_state[NOW] == L_AHEAD &&
 		    atomic_read(ap_in_flight) == 0) {
+			unsigned long delay = ahead_return_delay(peer_device->connection);
 			struct drbd_peer_device *pd;
 			int vnr;
 			/* The first peer device to notice that it is time to
@@ -714,7 +893,7 @@ static void mod_rq_state(struct drbd_request *req, struct bio_and_error *m,
 				if (test_and_set_bit(AHEAD_TO_SYNC_SOURCE, &pd->flags))
 					continue; /* already done */
 				pd->start_resync_side = L_SYNC_SOURCE;
-				pd->start_resync_timer.expires = jiffies + HZ;
+				pd->start_resync_timer.expires = jiffies + delay;
 				add_timer(&pd->start_resync_timer);
 			}
 		}
@@ -1193,6 +1372,8 @@ static void complete_conflicting_writes(struct drbd_request *req)
 	int size = req->i.size;
 
 	for (;;) {
+		if (!drbd_write_may_overlap(device, sector, size))
+			break;
 		drbd_for_each_overlap(i, &device->write_requests, sector, size) {
 			/* Ignore, if already completed to upper layers. */
 			if (i->completed)
@@ -1214,6 +1395,34 @@ static void complete_conflicting_writes(struct drbd_request *req)
 	finish_wait(&device->misc_wait, &wait);
 }
 
+/* Writes that are still replicated keep the peer Consistent, while the
+ * resync after Ahead leaves it Inconsistent until it is done. So with
+ * congestion_grace_ms set, give a burst the chance to drain through the
+ * socket and max-buffers first, and only pull ahead if it does not.
+ * Meanwhile, application writes may see the congestion as latency. */
+static bool congestion_outlasted_grace(struct drbd_peer_device *peer_device,
+				       bool over_threshold, int in_flight)
+{
+	unsigned int grace_ms = READ_ONCE(drbd_congestion_grace_ms);
+	unsigned int rate = peer_device->connection->ahead.rate;
+
+	if (!over_threshold) {
+		peer_device->congestion_since = 0;
+		return false;
+	}
+	if (!grace_ms)
+		return true;
+	/* At the rate the peer acked recently, the backlog will not drain
+	 * within the grace period anyway; do not stall writers for nothing. */
+	if (rate && (u64)in_flight / 2 * 1000 > (u64)rate * grace_ms)
+		return true;
+	if (!peer_device->congestion_since) {
+		peer_device->congestion_since = jiffies ?: 1;
+		return false;
+	}
+	return time_after_eq(jiffies, peer_device->congestion_since + msecs_to_jiffies(grace_ms));
+}
+
 /* called within req_lock and rcu_read_lock() */
 static void __maybe_pull_ahead(struct drbd_device *device, struct drbd_connection *connection)
 {
@@ -1239,8 +1448,10 @@ static void __maybe_pull_ahead(struct drbd_device *device, struct drbd_connectio
 	if (on_congestion == OC_BLOCK)
 		return;
 
-	if (on_congestion == OC_PULL_AHEAD && peer_device->repl_state[NOW] == L_AHEAD)
+	if (on_congestion == OC_PULL_AHEAD && peer_device->repl_state[NOW] == L_AHEAD) {
+		peer_device->congestion_since = 0;
 		return; /* nothing to do ... */
+	}
 
 	/* If I don't even have good local storage, we can not reasonably try
 	 * to pull ahead of the peer. We also need the local reference to make
@@ -1252,23 +1463,33 @@ static void __maybe_pull_ahead(struct drbd_device *device, struct drbd_connectio
 	/* if an other volume already found that we are congested, short circuit. */
 	congested = test_bit(CONN_CONGESTED, &connection->flags);
 
-	if (!congested && cong_fill) {
+	if (!congested) {
 		int n = atomic_read(&connection->ap_in_flight) +
 			atomic_read(&connection->rs_in_flight);
-		if (n >= cong_fill) {
+		bool fill = cong_fill && n >= cong_fill;
+		bool extents = device->act_log->used >= cong_extents;
+
+		/* The grace period is tracked per volume: cong_extents is a
+		 * per volume threshold, and one volume falling below it must
+		 * not restart the grace period of another one above it. */
+		if (!congestion_outlasted_grace(peer_device, fill || extents, n)) {
+			/* below the thresholds, or keep replicating for now */
+		} else if (fill) {
 			drbd_info(device, "Congestion-fill threshold reached (%d >= %d)\n", n, cong_fill);
 			congested = true;
+		} else {
+			drbd_info(device, "Congestion-extents threshold reached (%d >= %d)\n",
+				device->act_log->used, cong_extents);
+			congested = true;
 		}
 	}
 
-	if (!congested && device->act_log->used >= cong_extents) {
-		drbd_info(device, "Congestion-extents threshold reached (%d >= %d)\n",
-			device->act_log->used, cong_extents);
-		congested = true;
-	}
-
 	if (congested) {
 		struct drbd_resource *resource = device->resource;
+		enum drbd_state_rv rv;
+
+		/* decided; the next congestion gets a grace period of its own */
+		peer_device->congestion_since = 0;
 
 		set_bit(CONN_CONGESTED, &connection->flags);
 
@@ -1280,7 +1501,11 @@ static void __maybe_pull_ahead(struct drbd_device *device, struct drbd_connectio
 			__change_repl_state(peer_device, L_AHEAD);
 		else			/* on_congestion == OC_DISCONNECT */
 			__change_cstate(peer_device->connection, C_DISCONNECTING);
-		end_state_change_locked(resource);
+		rv = end_state_change_locked(resource);
+
+		if (on_congestion == OC_PULL_AHEAD && rv >= SS_SUCCESS &&
+		    first_volume_ahead(connection, peer_device))
+			ahead_note_pulled_ahead(connection);
 	}
 	put_ldev(device);
 }
@@ -1431,7 +1656,7 @@ static int drbd_process_write_request(struct drbd_request *req)
 			if (!in_tree) {
 				/* Corresponding drbd_remove_request_interval is in
 				 * drbd_req_complete() */
-				drbd_insert_interval(&device->write_requests, &req->i);
+				drbd_insert_write_interval(device, &req->i);
 				in_tree = true;
 			}
 			_req_mod(req, QUEUE_FOR_NET_WRITE, peer_device);
@@ -1780,6 +2005,7 @@ static void drbd_send_and_submit(struct drbd_device *device, struct drbd_request
 		/* pre_submit_jif is used in request_timer_fn() */
 		req->pre_submit_jif = jiffies;
 		ktime_get_accounting(req->pre_submit_kt);
+		req->local_submit_kt = READ_ONCE(drbd_rs_app_latency_us) ? ktime_get() : 0;
 		list_add_tail(&req->req_pending_local,
 			&device->pending_completion[rw == WRITE]);
 		_req_mod(req, TO_BE_SUBMITTED, NULL);
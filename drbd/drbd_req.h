@@ -303,6 +303,9 @@ extern void __tl_walk(struct drbd_resource *const resource,
 		const enum drbd_req_event what);
 extern void drbd_queue_peer_ack(struct drbd_resource *resource, struct drbd_request *req);
 extern bool drbd_should_do_remote(struct drbd_peer_device *, enum which_state);
+extern void drbd_insert_write_interval(struct drbd_device *, struct drbd_interval *);
+extern void drbd_remove_write_interval(struct drbd_device *, struct drbd_interval *);
+extern bool drbd_write_may_overlap(struct drbd_device *, sector_t, unsigned int);
 
 /* this is in drbd_main.c */
 extern void drbd_restart_request(struct drbd_request *req);
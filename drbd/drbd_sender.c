@@ -85,6 +85,117 @@ void drbd_md_endio(struct bio *bio)
 	wake_up(&device->misc_wait);
 }
 
+/* Online verify digests are computed on the CPU that completed the read,
+ * by a per-CPU work item, instead of one after the other in the sender.
+ * The sender then only sends the digest or the result. */
+struct verify_digest_queue {
+	spinlock_t lock;
+	struct list_head peer_reqs;
+	struct work_struct work;
+};
+static DEFINE_PER_CPU(struct verify_digest_queue, verify_digest_queues);
+static struct workqueue_struct *verify_digest_wq;
+
+static void verify_digest(struct drbd_peer_request *peer_req)
+{
+	struct crypto_shash *tfm = peer_req->peer_device->connection->verify_tfm;
+	int digest_size = crypto_shash_digestsize(tfm);
+	struct digest_info *di;
+	void *digest;
+
+	if (peer_req->w.cb == w_e_end_ov_req) {
+		/* we are the verify target, keep the digest for the sender */
+		di = kmalloc(sizeof(*di) + digest_size, GFP_NOIO);
+		if (!di)
+			return;
+		di->digest_size = digest_size;
+		di->digest = ((char *)di) + sizeof(struct digest_info);
+		drbd_csum_pages(tfm, peer_req->page_chain.head, di->digest);
+		peer_req->digest = di;
+		peer_req->flags |= EE_HAS_DIGEST | EE_DIGEST_DONE;
+	} else {
+		/* we are the verify source, compare with the peer's digest */
+		di = peer_req->digest;
+		digest = kmalloc(digest_size, GFP_NOIO);
+		if (!digest)
+			return;
+		drbd_csum_pages(tfm, peer_req->page_chain.head, digest);
+		if (digest_size == di->digest_size &&
+		    !memcmp(digest, di->digest, digest_size))
+			peer_req->flags |= EE_DIGEST_EQUAL;
+		peer_req->flags |= EE_DIGEST_DONE;
+		kfree(digest);
+	}
+}
+
+static void do_verify_digests(struct work_struct *ws)
+{
+	struct verify_digest_queue *q = container_of(ws, struct verify_digest_queue, work);
+	struct drbd_peer_request *peer_req, *tmp;
+	LIST_HEAD(peer_reqs);
+
+	spin_lock_irq(&q->lock);
+	list_splice_init(&q->peer_reqs, &peer_reqs);
+	spin_unlock_irq(&q->lock);
+
+	list_for_each_entry_safe(peer_req, tmp, &peer_reqs, w.list) {
+		list_del_init(&peer_req->w.list);
+		verify_digest(peer_req);
+		drbd_queue_work(&peer_req->peer_device->connection->sender_work, &peer_req->w);
+	}
+}
+
+static bool queue_verify_digest(struct drbd_peer_request *peer_req)
+{
+	struct verify_digest_queue *q;
+	unsigned long flags;
+
+	if (!verify_digest_wq ||
+	    test_bit(__EE_WAS_ERROR, &peer_req->flags) ||
+	    (peer_req->w.cb != w_e_end_ov_req && peer_req->w.cb != w_e_end_ov_reply))
+		return false;
+
+	local_irq_save(flags);
+	q = this_cpu_ptr(&verify_digest_queues);
+	spin_lock(&q->lock);
+	list_add_tail(&peer_req->w.list, &q->peer_reqs);
+	spin_unlock(&q->lock);
+	queue_work_on(smp_processor_id(), verify_digest_wq, &q->work);
+	local_irq_restore(flags);
+	return true;
+}
+
+int drbd_create_digest_workqueue(void)
+{
+	int cpu;
+
+	verify_digest_wq = alloc_workqueue("drbd_verify_digest", WQ_MEM_RECLAIM, 0);
+	if (!verify_digest_wq)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct verify_digest_queue *q = per_cpu_ptr(&verify_digest_queues, cpu);
+
+		spin_lock_init(&q->lock);
+		INIT_LIST_HEAD(&q->peer_reqs);
+		INIT_WORK(&q->work, do_verify_digests);
+	}
+	return 0;
+}
+
+void drbd_destroy_digest_workqueue(void)
+{
+	if (verify_digest_wq)
+		destroy_workqueue(verify_digest_wq);
+}
+
+/* Before flushing sender_work, so nothing is still on its way there. */
+void drbd_flush_digest_workqueue(void)
+{
+	if (verify_digest_wq)
+		flush_workqueue(verify_digest_wq);
+}
+
 /* reads on behalf of the partner,
  * "submitted" by the receiver
  */
@@ -104,7 +215,8 @@ static void drbd_endio_read_sec_final(struct drbd_peer_request *peer_req) __rele
 		__drbd_chk_io_error(device, DRBD_READ_ERROR);
 	spin_unlock_irqrestore(&device->resource->req_lock, flags);
 
-	drbd_queue_work(&connection->sender_work, &peer_req->w);
+	if (!queue_verify_digest(peer_req))
+		drbd_queue_work(&connection->sender_work, &peer_req->w);
 	put_ldev(device);
 }
 
@@ -194,6 +306,18 @@ void drbd_endio_write_sec_final(struct drbd_peer_request *peer_req) __releases(l
 	put_ldev(device);
 }
 
+/* Smoothed (7/8 old, 1/8 new) completion latency of application requests
+ * on the backing device. Concurrent completions may lose an update, which
+ * does not matter for a moving average. */
+static void drbd_app_latency_sample(struct drbd_device *device, ktime_t submit_kt)
+{
+	unsigned long us = ktime_us_delta(ktime_get(), submit_kt);
+	unsigned long avg = READ_ONCE(device->app_lat_us);
+
+	WRITE_ONCE(device->app_lat_us, avg - avg / 8 + us / 8);
+	WRITE_ONCE(device->app_lat_jif, jiffies);
+}
+
 /* writes on behalf of the partner, or resync writes,
  * "submitted" by the receiver.
  */
@@ -218,6 +342,9 @@ void drbd_peer_request_endio(struct bio *bio)
 
 	bio_put(bio); /* no need for the bio anymore */
 	if (atomic_dec_and_test(&peer_req->pending_bios)) {
+		/* on a secondary, the peer's requests are the application I/O */
+		if (peer_req->submit_kt)
+			drbd_app_latency_sample(device, peer_req->submit_kt);
 		if (is_write)
 			drbd_endio_write_sec_final(peer_req);
 		else
@@ -299,6 +426,8 @@ void drbd_request_endio(struct bio *bio)
 		}
 	} else {
 		what = COMPLETED_OK;
+		if (req->local_submit_kt)
+			drbd_app_latency_sample(device, req->local_submit_kt);
 	}
 
 	bio_put(req->private_bio);
@@ -360,6 +489,47 @@ void drbd_csum_bio(struct crypto_shash *tfm, struct bio *bio, void *digest)
 	shash_desc_zero(desc);
 }
 
+/* memchr_inv() compares a word at a time and stops at the first
+ * non-zero byte, which for real data is right at the start. */
+bool drbd_pages_all_zero(struct page *page, unsigned int size)
+/* kmap compat: KM_USER1 */
+{
+	page_chain_for_each(page) {
+		unsigned int l = min_t(unsigned int, size, PAGE_SIZE);
+		void *d;
+		bool zero;
+
+		d = kmap_atomic(page);
+		zero = !memchr_inv(d, 0, l);
+		kunmap_atomic(d);
+		if (!zero)
+			return false;
+		size -= l;
+	}
+
+	return true;
+}
+
+bool drbd_bio_all_zero(struct bio *bio)
+/* kmap compat: KM_USER1 */
+{
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		void *d;
+		bool zero;
+
+		d = kmap_atomic(bvec.bv_page);
+		zero = !memchr_inv(d + bvec.bv_offset, 0, bvec.bv_len);
+		kunmap_atomic(d);
+		if (!zero)
+			return false;
+	}
+
+	return true;
+}
+
 /* MAYBE merge common code with w_e_end_ov_req */
 static int w_e_send_csum(struct drbd_work *w, int cancel)
 {
@@ -623,11 +793,86 @@ static int drbd_rs_controller(struct drbd_peer_device *peer_device, u64 sect_in,
 	return req_sect;
 }
 
+/* Latency feedback controller: Grow the number of resync sectors in flight
+ * additively as long as the round trip of resync requests stays within
+ * target_us, back off multiplicatively if it does not, or if the send
+ * buffer filled up.  The round trip is derived from the amount in flight
+ * and the rate it came back (Little's law), so it includes the network
+ * and the peer's backing device.
+ */
+static int drbd_rs_latency_controller(struct drbd_peer_device *peer_device, u64 sect_in, u64 duration_ns,
+				      unsigned int target_us)
+{
+	const u64 max_duration_ns = RS_MAKE_REQS_INTV_NS * 10;
+	const unsigned int min_want = BM_SECT_PER_BIT * 8;
+	u64 target_ns = (u64)target_us * NSEC_PER_USEC;
+	u64 in_flight = peer_device->rs_in_flight + sect_in; /* at the start of this turn */
+	struct peer_device_conf *pdc;
+	u64 rtt_ns, max_sect;
+	int req_sect;
+
+	if (duration_ns == 0)
+		duration_ns = 1;
+	else if (duration_ns > max_duration_ns)
+		duration_ns = max_duration_ns;
+
+	pdc = rcu_dereference(peer_device->conf);
+
+	if (sect_in) {
+		rtt_ns = in_flight * duration_ns;
+		do_div(rtt_ns, sect_in);
+	} else if (in_flight) {
+		/* nothing came back during a whole turn */
+		rtt_ns = max(peer_device->rs_lat.rtt_ns, duration_ns);
+	} else {
+		rtt_ns = peer_device->rs_lat.rtt_ns;
+	}
+	if (peer_device->rs_lat.rtt_ns)
+		rtt_ns = (peer_device->rs_lat.rtt_ns * 7 + rtt_ns) >> 3;
+	peer_device->rs_lat.rtt_ns = rtt_ns;
+
+	if (peer_device->rs_lat.want == 0) /* At start of resync */
+		peer_device->rs_lat.want = (pdc->resync_rate * 2 * RS_MAKE_REQS_INTV) / HZ;
+
+	if (peer_device->rs_lat.congested || rtt_ns > target_ns) {
+		peer_device->rs_lat.want -= peer_device->rs_lat.want >> 2;
+		peer_device->rs_lat.decreases++;
+	} else if (in_flight * 2 >= peer_device->rs_lat.want) {
+		/* only grow if we actually made use of what we had */
+		peer_device->rs_lat.want += max(peer_device->rs_lat.want >> 3, min_want);
+		peer_device->rs_lat.increases++;
+	}
+	peer_device->rs_lat.want = max(peer_device->rs_lat.want, min_want);
+	peer_device->rs_lat.congested = false;
+
+	req_sect = (int)peer_device->rs_lat.want - peer_device->rs_in_flight;
+	if (req_sect < 0)
+		req_sect = 0;
+
+	if (pdc->c_max_rate == 0) {
+		/* No rate limiting. */
+		max_sect = ~0ULL;
+	} else {
+		max_sect = (u64)pdc->c_max_rate * 2 * duration_ns;
+		do_div(max_sect, NSEC_PER_SEC);
+	}
+
+	dynamic_drbd_dbg(peer_device, "dur=%lluns sect_in=%llu in_flight=%d rtt=%lluns wa=%u rs=%d mx=%llu\n",
+		 duration_ns, sect_in, peer_device->rs_in_flight, rtt_ns,
+		 peer_device->rs_lat.want, req_sect, max_sect);
+
+	if (req_sect > max_sect)
+		req_sect = max_sect;
+
+	return req_sect;
+}
+
 static int drbd_rs_number_requests(struct drbd_peer_device *peer_device)
 {
 	struct net_conf *nc;
 	ktime_t duration, now;
 	unsigned int sect_in;  /* Number of sectors that came in since the last turn */
+	unsigned int latency_target_us = READ_ONCE(drbd_rs_latency_target_us);
 	int number, mxb;
 
 	sect_in = atomic_xchg(&peer_device->rs_sect_in, 0);
@@ -640,7 +885,11 @@ static int drbd_rs_number_requests(struct drbd_peer_device *peer_device)
 	rcu_read_lock();
 	nc = rcu_dereference(peer_device->connection->transport.net_conf);
 	mxb = nc ? nc->max_buffers : 0;
-	if (rcu_dereference(peer_device->rs_plan_s)->size) {
+	if (latency_target_us) {
+		number = drbd_rs_latency_controller(peer_device, sect_in, ktime_to_ns(duration),
+						    latency_target_us) >> (BM_BLOCK_SHIFT - 9);
+		peer_device->c_sync_rate = number * HZ * (BM_BLOCK_SIZE / 1024) / RS_MAKE_REQS_INTV;
+	} else if (rcu_dereference(peer_device->rs_plan_s)->size) {
 		number = drbd_rs_controller(peer_device, sect_in, ktime_to_ns(duration)) >> (BM_BLOCK_SHIFT - 9);
 		peer_device->c_sync_rate = number * HZ * (BM_BLOCK_SIZE / 1024) / RS_MAKE_REQS_INTV;
 	} else {
@@ -701,6 +950,44 @@ static int drbd_resync_delay(struct drbd_peer_device *peer_device)
 	return delay;
 }
 
+/* Checksum based resync only pays off if a fair share of the blocks turns out
+ * to be identical.  Otherwise the sync target reads every block once more,
+ * and both sides pay for digests and an extra round trip, for nothing.
+ * Judge that per window of resolved blocks.  If less than 1/8 was identical,
+ * request the data right away for a few windows, then probe again. */
+#define RS_CSUM_WINDOW		(64UL << (20 - BM_BLOCK_SHIFT)) /* 64MiB */
+#define RS_CSUM_PLAIN_WINDOWS	4
+
+static bool rs_want_csums(struct drbd_peer_device *peer_device)
+{
+	unsigned long done, same;
+
+	if (!peer_device->use_csums)
+		return false;
+
+	done = peer_device->rs_total - drbd_bm_total_weight(peer_device);
+	if (done < peer_device->rs_csum_adapt.window_done) {
+		/* resync restarted */
+		peer_device->rs_csum_adapt.window_done = done;
+		peer_device->rs_csum_adapt.window_same = peer_device->rs_same_csum;
+	}
+	if (done - peer_device->rs_csum_adapt.window_done < RS_CSUM_WINDOW)
+		return peer_device->rs_csum_adapt.plain_windows == 0;
+
+	same = peer_device->rs_same_csum - peer_device->rs_csum_adapt.window_same;
+	if (peer_device->rs_csum_adapt.plain_windows) {
+		peer_device->rs_csum_adapt.plain_windows--;
+	} else if (same * 8 < done - peer_device->rs_csum_adapt.window_done) {
+		dynamic_drbd_dbg(peer_device, "csums: %lu of %lu blocks identical, requesting data\n",
+				 same, done - peer_device->rs_csum_adapt.window_done);
+		peer_device->rs_csum_adapt.plain_windows = RS_CSUM_PLAIN_WINDOWS;
+	}
+	peer_device->rs_csum_adapt.window_done = done;
+	peer_device->rs_csum_adapt.window_same = peer_device->rs_same_csum;
+
+	return peer_device->rs_csum_adapt.plain_windows == 0;
+}
+
 static int make_resync_request(struct drbd_peer_device *peer_device, int cancel)
 {
 	struct drbd_device *device = peer_device->device;
@@ -709,10 +996,12 @@ static int make_resync_request(struct drbd_peer_device *peer_device, int cancel)
 	sector_t sector;
 	const sector_t capacity = get_capacity(device->vdisk);
 	int max_bio_size;
+	unsigned long run_end, run_last;
 	int number, rollback_i, size;
 	int align;
 	int i;
 	int discard_granularity = 0;
+	bool use_csums;
 
 	if (unlikely(cancel))
 		return 0;
@@ -748,6 +1037,7 @@ static int make_resync_request(struct drbd_peer_device *peer_device, int cancel)
 	}
 
 	max_bio_size = queue_max_hw_sectors(device->rq_queue) << 9;
+	use_csums = rs_want_csums(peer_device);
 	number = drbd_rs_number_requests(peer_device);
 	/* don't let rs_sectors_came_in() re-schedule us "early"
 	 * just because the first reply came "fast", ... */
@@ -766,6 +1056,7 @@ static int make_resync_request(struct drbd_peer_device *peer_device, int cancel)
 			sndbuf = transport_stats.send_buffer_size;
 			if (queued > sndbuf / 2) {
 				send_buffer_ok = false;
+				peer_device->rs_lat.congested = true;
 				transport->ops->hint(transport, DATA_STREAM, NOSPACE);
 			}
 		} else
@@ -801,7 +1092,22 @@ next_sector:
 		 *
 		 * Additionally always align bigger requests, in order to
 		 * be prepared for all stripe sizes of software RAIDs.
+		 *
+		 * Look up the end of the dirty run once, instead of
+		 * testing (and locking the bitmap for) each bit. Only as
+		 * far as this request can reach: max_bio_size, the end of
+		 * the resync extent, and the end of the bitmap. Not finding
+		 * a clear bit up to run_last means the run reaches it.
 		 */
+		run_last = min3(bit + (max_bio_size >> BM_BLOCK_SHIFT) - 1,
+				bit | BM_BLOCKS_PER_BM_EXT_MASK,
+				drbd_bm_bits(device) - 1);
+		run_end = bit + 1;
+		if (run_last > bit) {
+			run_end = drbd_bm_range_find_next_zero(peer_device, bit + 1, run_last);
+			if (run_end == DRBD_END_OF_BITMAP || run_end > run_last)
+				run_end = run_last + 1;
+		}
 		align = 1;
 		rollback_i = i;
 		while (i + 1 < number) {
@@ -818,12 +1124,8 @@ next_sector:
 			/* do not cross extent boundaries */
 			if (((bit+1) & BM_BLOCKS_PER_BM_EXT_MASK) == 0)
 				break;
-			/* now, is it actually dirty, after all?
-			 * caution, drbd_bm_test_bit is tri-state for some
-			 * obscure reason; ( b == 0 ) would get the out-of-band
-			 * only accidentally right because of the "oddly sized"
-			 * adjustment below */
-			if (drbd_bm_test_bit(peer_device, bit + 1) != 1)
+			/* now, is it actually dirty, after all? */
+			if (bit + 1 >= run_end)
 				break;
 			bit++;
 			size += BM_BLOCK_SIZE;
@@ -838,7 +1140,7 @@ next_sector:
 		if (sector + (size>>9) > capacity)
 			size = (capacity-sector)<<9;
 
-		if (peer_device->use_csums) {
+		if (use_csums) {
 			switch (read_for_csum(peer_device, sector, size)) {
 			case -EIO: /* Disk failure */
 				put_ldev(device);
@@ -868,6 +1170,9 @@ next_sector:
 				return err;
 			}
 		}
+		peer_device->rs_req_sizes[min_t(unsigned int,
+						ilog2(DIV_ROUND_UP(size, BM_BLOCK_SIZE)),
+						RS_REQ_SIZE_BUCKETS - 1)]++;
 	}
 
 request_done:
@@ -897,6 +1202,20 @@ request_done:
 	return 0;
 }
 
+/* With verify_gib_per_hour set, online verify of a large device runs
+ * at an even pace: allow as many requests as are due since it started. */
+static int ov_scheduled_requests(struct drbd_peer_device *peer_device)
+{
+	unsigned int gib_per_hour = min(READ_ONCE(drbd_verify_gib_per_hour), 1U << 12);
+	u64 ms = jiffies_to_msecs(jiffies - peer_device->ov_sched_start);
+	u64 due = div_u64((u64)gib_per_hour * ms << (30 - BM_BLOCK_SHIFT),
+			  3600 * MSEC_PER_SEC);
+
+	if (due <= peer_device->ov_sched_sent)
+		return 0;
+	return min_t(u64, due - peer_device->ov_sched_sent, INT_MAX);
+}
+
 static int make_ov_request(struct drbd_peer_device *peer_device, int cancel)
 {
 	struct drbd_device *device = peer_device->device;
@@ -909,6 +1228,8 @@ static int make_ov_request(struct drbd_peer_device *peer_device, int cancel)
 		return 1;
 
 	number = drbd_rs_number_requests(peer_device);
+	if (drbd_verify_gib_per_hour)
+		number = min(number, ov_scheduled_requests(peer_device));
 	sector = peer_device->ov_position;
 
 	/* don't let rs_sectors_came_in() re-schedule us "early"
@@ -945,6 +1266,7 @@ static int make_ov_request(struct drbd_peer_device *peer_device, int cancel)
 	/* ... but do a correction, in case we had to break; ... */
 	peer_device->rs_in_flight -= (number-i) * BM_SECT_PER_BIT;
 	peer_device->ov_position = sector;
+	peer_device->ov_sched_sent += i;
 	if (stop_sector_reached)
 		return 1;
 	/* ... and in case that raced with the receiver,
@@ -1426,31 +1748,6 @@ int w_e_end_data_req(struct drbd_work *w, int cancel)
 	return err;
 }
 
-static bool all_zero(struct drbd_peer_request *peer_req)
-/* kmap compat: KM_USER1 */
-{
-	struct page *page = peer_req->page_chain.head;
-	unsigned int len = peer_req->i.size;
-
-	page_chain_for_each(page) {
-		unsigned int l = min_t(unsigned int, len, PAGE_SIZE);
-		unsigned int i, words = l / sizeof(long);
-		unsigned long *d;
-
-		d = kmap_atomic(page);
-		for (i = 0; i < words; i++) {
-			if (d[i]) {
-				kunmap_atomic(d);
-				return false;
-			}
-		}
-		kunmap_atomic(d);
-		len -= l;
-	}
-
-	return true;
-}
-
 /**
  * w_e_end_rsdata_req() - Worker callback to send a P_RS_DATA_REPLY packet in response to a P_RS_DATA_REQUEST
  * @w:		work object.
@@ -1486,7 +1783,9 @@ int w_e_end_rsdata_req(struct drbd_work *w, int cancel)
 			 * the atomic_sub() in got_BlockAck.
 			 * TODO: to fix that, we'd need a protocol bump. */
 			atomic_add(peer_req->i.size >> 9, &connection->rs_in_flight);
-			if (peer_req->flags & EE_RS_THIN_REQ && all_zero(peer_req)) {
+			if (peer_req->flags & EE_RS_THIN_REQ &&
+			    drbd_pages_all_zero(peer_req->page_chain.head, peer_req->i.size)) {
+				peer_device->rs_deallocated += peer_req->i.size >> BM_BLOCK_SHIFT;
 				err = drbd_send_rs_deallocated(peer_device, peer_req);
 			} else {
 				err = drbd_send_block(peer_device, P_RS_DATA_REPLY, peer_req);
@@ -1566,6 +1865,7 @@ int w_e_end_csum_rs_req(struct drbd_work *w, int cancel)
 			peer_req->flags &= ~EE_HAS_DIGEST; /* This peer request no longer has a digest pointer */
 			kfree(di);
 			atomic_add(peer_req->i.size >> 9, &peer_device->connection->rs_in_flight);
+			drbd_sender_uncork_control(peer_device->connection);
 			err = drbd_send_block(peer_device, P_RS_DATA_REPLY, peer_req);
 		}
 	} else {
@@ -1601,7 +1901,9 @@ int w_e_end_ov_req(struct drbd_work *w, int cancel)
 		goto out;
 	}
 
-	if (!(peer_req->flags & EE_WAS_ERROR))
+	if (peer_req->flags & EE_DIGEST_DONE)
+		memcpy(digest, peer_req->digest->digest, digest_size);
+	else if (!(peer_req->flags & EE_WAS_ERROR))
 		drbd_csum_pages(peer_device->connection->verify_tfm, peer_req->page_chain.head, digest);
 	else
 		memset(digest, 0, digest_size);
@@ -1683,7 +1985,9 @@ int w_e_end_ov_reply(struct drbd_work *w, int cancel)
 
 	di = peer_req->digest;
 
-	if (likely((peer_req->flags & EE_WAS_ERROR) == 0)) {
+	if (peer_req->flags & EE_DIGEST_DONE) {
+		eq = !!(peer_req->flags & EE_DIGEST_EQUAL);
+	} else if (likely((peer_req->flags & EE_WAS_ERROR) == 0)) {
 		digest_size = crypto_shash_digestsize(peer_device->connection->verify_tfm);
 		digest = kmalloc(digest_size, GFP_NOIO);
 		if (digest) {
@@ -1964,6 +2268,9 @@ void drbd_rs_controller_reset(struct drbd_peer_device *peer_device)
 	atomic_set(&peer_device->device->rs_sect_ev, 0);  /* FIXME: ??? */
 	peer_device->rs_last_mk_req_kt = ktime_get();
 	peer_device->rs_in_flight = 0;
+	memset(&peer_device->rs_lat, 0, sizeof(peer_device->rs_lat));
+	memset(peer_device->rs_req_sizes, 0, sizeof(peer_device->rs_req_sizes));
+	memset(&peer_device->rs_csum_adapt, 0, sizeof(peer_device->rs_csum_adapt));
 	peer_device->rs_last_events = (int)part_stat_read(part, sectors[0])
 		+ (int)part_stat_read(part, sectors[1]);
 
@@ -2488,6 +2795,49 @@ static void do_device_work(struct drbd_device *device, const unsigned long todo)
 		make_new_current_uuid(device);
 }
 
+void resume_verify_timer_fn(struct timer_list *t)
+{
+	struct drbd_peer_device *peer_device = from_timer(peer_device, t, resume_verify_timer);
+	drbd_peer_device_post_work(peer_device, OV_RESUME);
+}
+
+/* Restart an online verify from where the connection loss stopped it.
+ * Same constraints as for try_become_up_to_date(): no two-phase commit
+ * from the worker while twopc_work is queued, no waiting on state_sem.
+ * In those cases, and while bitmap work is pending, try again later. */
+static void do_resume_verify(struct drbd_peer_device *peer_device)
+{
+	struct drbd_device *device = peer_device->device;
+	struct drbd_resource *resource = device->resource;
+	enum drbd_state_rv rv;
+
+	/* Lost the connection again, or a verify run was started meanwhile.
+	 * The next time we reach L_ESTABLISHED posts OV_RESUME again. */
+	if (peer_device->repl_state[NOW] != L_ESTABLISHED ||
+	    !test_bit(OV_INTERRUPTED, &peer_device->flags))
+		return;
+
+	if (atomic_read(&device->pending_bitmap_work.n) ||
+	    !list_empty(&resource->twopc_work.list))
+		goto repost;
+	if (down_trylock(&resource->state_sem))
+		goto repost;
+
+	drbd_info(peer_device, "Resuming Online Verify at sector %llu\n",
+		  (unsigned long long)peer_device->ov_start_sector);
+	rv = change_repl_state(peer_device, L_VERIFY_S, CS_ALREADY_SERIALIZED |
+			       CS_VERBOSE | CS_SERIALIZE | CS_DONT_RETRY);
+	up(&resource->state_sem);
+	if (rv == SS_TIMEOUT || rv == SS_CONCURRENT_ST_CHG)
+		goto repost;
+	if (rv < SS_SUCCESS)
+		drbd_info(peer_device, "Resuming Online Verify failed\n");
+	return;
+
+repost:
+	mod_timer(&peer_device->resume_verify_timer, jiffies + HZ/10);
+}
+
 static void do_peer_device_work(struct drbd_peer_device *peer_device, const unsigned long todo)
 {
 	if (test_bit(RS_PROGRESS, &todo))
@@ -2497,6 +2847,8 @@ static void do_peer_device_work(struct drbd_peer_device *peer_device, const unsi
 		update_on_disk_bitmap(peer_device, test_bit(RS_DONE, &todo));
 	if (test_bit(RS_START, &todo))
 		do_start_resync(peer_device);
+	if (test_bit(OV_RESUME, &todo))
+		do_resume_verify(peer_device);
 }
 
 #define DRBD_RESOURCE_WORK_MASK	\
@@ -2514,6 +2866,7 @@ static void do_peer_device_work(struct drbd_peer_device *peer_device, const unsi
 	|(1UL << RS_LAZY_BM_WRITE)	\
 	|(1UL << RS_PROGRESS)		\
 	|(1UL << RS_DONE)		\
+	|(1UL << OV_RESUME)		\
 	)
 
 static unsigned long get_work_bits(const unsigned long mask, unsigned long *flags)
@@ -2996,9 +3349,46 @@ static int process_one_request(struct drbd_connection *connection)
 	return err;
 }
 
+/* Resync and verify replies (P_RS_IS_IN_SYNC, P_OV_RESULT, P_NEG_RS_DREPLY...)
+ * are sent on the control stream by the work items themselves. While the
+ * sender works through consecutive such items, let the replies accumulate
+ * in the send buffer and go out with a single send, instead of one packet
+ * per reply. The ack_sender corks the control stream as well, so both use
+ * drbd_cork_nested(). Uncork before anything else, in particular before any
+ * send on the data stream, which may block on a congested socket. */
+static bool is_rs_reply_work(struct drbd_work *w)
+{
+	return w->cb == w_e_end_csum_rs_req || w->cb == w_e_end_ov_reply;
+}
+
+static void sender_cork_control(struct drbd_connection *connection)
+{
+	struct net_conf *nc;
+	bool cork;
+
+	rcu_read_lock();
+	nc = rcu_dereference(connection->transport.net_conf);
+	cork = nc ? nc->tcp_cork : false;
+	rcu_read_unlock();
+
+	if (cork) {
+		drbd_cork_nested(connection, CONTROL_STREAM);
+		connection->sender_corked_control = true;
+	}
+}
+
+void drbd_sender_uncork_control(struct drbd_connection *connection)
+{
+	if (connection->sender_corked_control) {
+		connection->sender_corked_control = false;
+		drbd_uncork_nested(connection, CONTROL_STREAM);
+	}
+}
+
 static int process_sender_todo(struct drbd_connection *connection)
 {
 	struct drbd_work *w = NULL;
+	int err = 0;
 
 	/* Process all currently pending work items,
 	 * or requests from the transfer log.
@@ -3017,29 +3407,38 @@ static int process_sender_todo(struct drbd_connection *connection)
 		return process_one_request(connection);
 	}
 
-	while (!list_empty(&connection->todo.work_list)) {
-		int err;
+	if (list_empty(&connection->todo.work_list))
+		return 0;
 
+	while (!list_empty(&connection->todo.work_list)) {
 		w = list_first_entry(&connection->todo.work_list, struct drbd_work, list);
+		if (!is_rs_reply_work(w))
+			drbd_sender_uncork_control(connection);
+		else if (!connection->sender_corked_control &&
+			 !list_is_last(&w->list, &connection->todo.work_list) &&
+			 is_rs_reply_work(list_next_entry(w, list)))
+			sender_cork_control(connection);
 		list_del_init(&w->list);
 		update_sender_timing_details(connection, w->cb);
 		err = w->cb(w, connection->cstate[NOW] < C_CONNECTED);
 		if (err)
-			return err;
+			break;
 
 		/* If we would need strict ordering for work items, we could
 		 * add a dagtag member to struct drbd_work, and serialize based on that.
 		 * && !dagtag_newer(connection->todo.req->dagtag_sector, w->dagtag_sector))
 		 * to the following condition. */
 		if (connection->todo.req) {
+			drbd_sender_uncork_control(connection);
 			update_sender_timing_details(connection, process_one_request);
 			err = process_one_request(connection);
 		}
 		if (err)
-			return err;
+			break;
 	}
+	drbd_sender_uncork_control(connection);
 
-	return 0;
+	return err;
 }
 
 int drbd_sender(struct drbd_thread *thi)
@@ -3054,6 +3453,7 @@ int drbd_sender(struct drbd_thread *thi)
 	rcu_read_lock();
 	idr_for_each_entry(&connection->peer_devices, peer_device, vnr) {
 		peer_device->send_cnt = 0;
+		peer_device->send_zeroes_cnt = 0;
 		peer_device->recv_cnt = 0;
 	}
 	rcu_read_unlock();
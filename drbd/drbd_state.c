@@ -2296,6 +2296,8 @@ static void initialize_resync(struct drbd_peer_device *peer_device)
 	peer_device->rs_failed = 0;
 	peer_device->rs_paused = 0;
 	peer_device->rs_same_csum = 0;
+	peer_device->rs_deallocated = 0;
+	memset(&peer_device->rs_src, 0, sizeof(peer_device->rs_src));
 	peer_device->rs_last_sect_ev = 0;
 	peer_device->rs_total = tw;
 	peer_device->rs_start = now;
@@ -2425,8 +2427,15 @@ static void finish_state_change(struct drbd_resource *resource, struct completio
 				if (peer_device->ov_left)
 					drbd_info(peer_device, "Online Verify reached sector %llu\n",
 						  (unsigned long long)peer_device->ov_start_sector);
+				if (repl_state[OLD] == L_VERIFY_S && peer_device->ov_left &&
+				    connection->cstate[NEW] < C_CONNECTED && drbd_verify_auto_resume)
+					set_bit(OV_INTERRUPTED, &peer_device->flags);
 			}
 
+			if (repl_state[OLD] < L_ESTABLISHED && repl_state[NEW] == L_ESTABLISHED &&
+			    test_bit(OV_INTERRUPTED, &peer_device->flags) && drbd_verify_auto_resume)
+				drbd_peer_device_post_work(peer_device, OV_RESUME);
+
 			if ((repl_state[OLD] == L_PAUSED_SYNC_T || repl_state[OLD] == L_PAUSED_SYNC_S) &&
 			    (repl_state[NEW] == L_SYNC_TARGET  || repl_state[NEW] == L_SYNC_SOURCE)) {
 				drbd_info(peer_device, "Syncer continues.\n");
@@ -2451,12 +2460,20 @@ static void finish_state_change(struct drbd_resource *resource, struct completio
 			if (repl_state[OLD] >= L_ESTABLISHED && repl_state[NEW] < L_ESTABLISHED)
 				clear_bit(AHEAD_TO_SYNC_SOURCE, &peer_device->flags);
 
+			/* see congestion_outlasted_grace() */
+			if ((repl_state[OLD] == L_AHEAD && repl_state[NEW] != L_AHEAD) ||
+			    (repl_state[OLD] < L_ESTABLISHED && repl_state[NEW] >= L_ESTABLISHED))
+				peer_device->congestion_since = 0;
+
 			if (repl_state[OLD] == L_ESTABLISHED &&
 			    (repl_state[NEW] == L_VERIFY_S || repl_state[NEW] == L_VERIFY_T)) {
 				unsigned long now = jiffies;
 				int i;
 
 				set_ov_position(peer_device, repl_state[NEW]);
+				clear_bit(OV_INTERRUPTED, &peer_device->flags);
+				peer_device->ov_sched_start = now;
+				peer_device->ov_sched_sent = 0;
 				peer_device->rs_start = now;
 				peer_device->rs_last_sect_ev = 0;
 				peer_device->ov_last_oos_size = 0;
@@ -2517,6 +2534,7 @@ static void finish_state_change(struct drbd_resource *resource, struct completio
 				set_bit(SEND_STATE_AFTER_AHEAD_C, &connection->flags);
 
 				clear_bit(CONN_CONGESTED, &connection->flags);
+				connection->ahead.left = jiffies;
 				wake_up(&connection->sender_work.q_wait);
 			}
 